@@ -3,12 +3,16 @@
 
 namespace lince {
 class Interpreter;
+class ASTVisitor;
 
 class AST {
 public:
   virtual ~AST() = default;
-  virtual Value eval(Interpreter *) = 0;
-  virtual std::string dump() const { return ""; }
+  /// The value of the tree, or the error that stopped its evaluation.
+  virtual Expected<Value> eval(Interpreter *) = 0;
+  /// Single-line description of the tree, see printAST.
+  std::string dump() const;
+  virtual void accept(ASTVisitor &Visitor) const = 0;
 };
 
 } // namespace lince
\ No newline at end of file
@@ -1,52 +1,30 @@
 #pragma once
 #include "ast.hpp"
+#include "astprinter.hpp"
 
 #include <fmt/format.h>
 
+/// Formats a tree with printAST. The format spec selects the style:
+/// empty for PrintStyle::Tree, `c' for Compact and `j' for JSON.
 template <> struct fmt::formatter<lince::AST> {
-  int NIndent = 0;
+  lince::PrintStyle Style = lince::PrintStyle::Tree;
 
-  template <typename OutIt> static OutIt Indent(OutIt O) {
-    return format_to(O, " ");
-  }
-
-  template <typename OutIt> static OutIt Indent(OutIt O, int N) {
-    while (N--)
-      O = Indent(O);
-    return O;
-  }
-
-  template <typename OutIt> OutIt writeChar(OutIt O, char C) {
-    format_to(O, "{}", C);
-    if (C == '\n')
-      Indent(O, NIndent);
-    return O;
-  }
-
-  template <typename ParseContext> auto parse(ParseContext &C) {
-    return C.begin();
+  template <typename ParseContext> constexpr auto parse(ParseContext &C) {
+    auto It = C.begin();
+    if (It != C.end() && *It == 'c') {
+      Style = lince::PrintStyle::Compact;
+      ++It;
+    } else if (It != C.end() && *It == 'j') {
+      Style = lince::PrintStyle::JSON;
+      ++It;
+    }
+    return It;
   }
 
   template <typename FormatContext>
   auto format(const lince::AST &A, FormatContext &C) {
-    NIndent = 0;
-    auto ASTS = A.dump();
-    for (char X : ASTS) {
-      if (X == '{' || X == '[') {
-        NIndent++;
-        writeChar(C.out(), X);
-        writeChar(C.out(), '\n');
-      } else if (X == '}' || X == ']') {
-        NIndent--;
-        writeChar(C.out(), '\n');
-        writeChar(C.out(), X);
-      } else if (X == ',') {
-        writeChar(C.out(), X);
-        writeChar(C.out(), '\n');
-      } else {
-        writeChar(C.out(), X);
-      }
-    }
-    return C.out();
+    fmt::memory_buffer Out;
+    lince::printAST(A, Out, Style);
+    return std::copy(Out.begin(), Out.end(), C.out());
   }
 };
@@ -2,75 +2,289 @@
 #include "exceptions.hpp"
 #include "interpreter.hpp"
 
+#include <array>
+
 namespace lince {
 
-Value IdentifierAST::eval(Interpreter *C) { return C->getValue(getName()); }
+Expected<Value> IdentifierAST::eval(Interpreter *C) {
+  return C->tryGetValueOrFunction(getName(), getHash());
+}
+
+namespace {
+
+// Name of the function implementing the operator Op, a character below
+// 128, built once rather than on every evaluation. Other values name no
+// function.
+const std::string &operatorName(int Op) {
+  static const auto Names = [] {
+    std::array<std::string, 128> Names;
+    for (int I = 0; I != 128; ++I)
+      Names[I] = std::string("operator") + static_cast<char>(I);
+    return Names;
+  }();
+  static const std::string Invalid = "operator";
+  if (Op < 0 || Op >= static_cast<int>(Names.size()))
+    return Invalid;
+  return Names[Op];
+}
+
+const std::string &paramName(const AST &A) {
+  return dynamic_cast<const IdentifierAST &>(SharedAST::unwrap(A)).getName();
+}
+
+} // namespace
+
+bool SharedAST::isCacheable(Interpreter *C) const {
+  auto &K = *Target->Cached;
+  const auto Generation = C->getDispatchGeneration();
+  const auto Last = K.Checked.load(std::memory_order_relaxed);
+  if (Last >> 1 == Generation)
+    return Last & 1;
+  const bool Pure =
+      std::all_of(K.Calls.cbegin(), K.Calls.cend(),
+                  [&](const std::string &Name) { return C->isPure(Name); });
+  K.Checked.store(Generation << 1 | Pure, std::memory_order_relaxed);
+  return Pure;
+}
+
+Expected<Value> SharedAST::eval(Interpreter *C) {
+  auto &N = *Target;
+  if (!N.Cached || !isCacheable(C))
+    return N.Expr->eval(C);
+  auto &K = *N.Cached;
+  const auto Generation = C->getDispatchGeneration();
+  {
+    std::lock_guard<std::mutex> Lock(K.M);
+    if (K.HasResult && K.ResultGeneration == Generation)
+      return K.Result;
+  }
+  auto V = N.Expr->eval(C);
+  if (!V)
+    return V;
+  std::lock_guard<std::mutex> Lock(K.M);
+  K.Result = *V;
+  K.ResultGeneration = Generation;
+  K.HasResult = true;
+  return V;
+}
 
 std::vector<std::string> CallExprAST::getParams() const {
   std::vector<std::string> Ret;
   Ret.reserve(Args.size());
-  for (auto &&X : Args) {
-    Ret.emplace_back(dynamic_cast<const IdentifierAST &>(*X).getName());
-  }
+  for (auto &&X : Args)
+    Ret.push_back(paramName(*X));
   return Ret;
 }
 
-Value UnaryExprAST::eval(Interpreter *C) {
-  std::vector<Value> Arg;
-  Arg.emplace_back(Operand->eval(C));
-  return C->callFunction(std::string("operator") +
-                             reinterpret_cast<char(&)[]>(Op),
-                         std::move(Arg));
+std::vector<std::string> UnaryExprAST::getParams() const {
+  return {paramName(*Operand)};
 }
 
-Value BinExprAST::eval(Interpreter *C) {
+std::vector<std::string> BinExprAST::getParams() const {
+  return {paramName(*LHS), paramName(*RHS)};
+}
+
+Expected<Value> UnaryExprAST::eval(Interpreter *C) {
+  auto V = Operand->eval(C);
+  if (!V)
+    return V;
+  ArgumentList Arg(C->getEvalResource());
+  Arg.push_back(std::move(*V));
+  return C->tryCallFunction(operatorName(Op), std::move(Arg));
+}
+
+Expected<Value> BinExprAST::eval(Interpreter *C) {
   if (Op == '=') { // deal with assignments
     if (const auto Identifier =
             dynamic_cast<const IdentifierAST *>(LHS.get())) {
-      const auto V = RHS->eval(C);
-      C->setValue(Identifier->getName(), V);
-      return V;
+      auto V = RHS->eval(C);
+      if (!V)
+        return V;
+      return C->setValue(Identifier->getName(), Identifier->getHash(),
+                         std::move(*V));
     }
     if (const auto Func = dynamic_cast<const GenericCallExpr *>(LHS.get())) {
-      auto F = DynamicFunction(Func->getParams(), std::move(RHS));
-      return {C->addLocalFunction(Func->getFunctionName(), std::move(F))};
+      auto F = DynamicFunction(Func->getParams(), RHS);
+      return Value{C->addLocalFunction(Func->getFunctionName(), std::move(F))};
     }
 
-    throw ParseError("Syntax Error ");
+    return Error{Error::Parse, "Syntax Error "};
   }
 
-  std::vector<Value> Operands;
-  Operands.emplace_back(LHS->eval(C));
-  Operands.emplace_back(RHS->eval(C));
+  auto L = LHS->eval(C);
+  if (!L)
+    return L;
+  auto R = RHS->eval(C);
+  if (!R)
+    return R;
+  ArgumentList Operands(C->getEvalResource());
+  Operands.reserve(2);
+  Operands.push_back(std::move(*L));
+  Operands.push_back(std::move(*R));
+
+  return C->tryCallFunction(operatorName(Op), std::move(Operands));
+}
 
-  return C->callFunction(std::string("operator") +
-                             reinterpret_cast<char(&)[]>(Op),
-                         std::move(Operands));
+std::unique_ptr<AST> SequenceAST::append(std::unique_ptr<AST> LHS,
+                                         std::unique_ptr<AST> RHS) {
+  if (const auto S = dynamic_cast<SequenceAST *>(LHS.get())) {
+    S->Statements.push_back(std::move(RHS));
+    return LHS;
+  }
+  std::vector<std::unique_ptr<AST>> Statements;
+  Statements.push_back(std::move(LHS));
+  Statements.push_back(std::move(RHS));
+  return std::make_unique<SequenceAST>(std::move(Statements));
 }
 
-Value CallExprAST::eval(Interpreter *C) {
-  std::vector<Value> ArgV;
+std::vector<std::string> SequenceAST::getParams() const {
+  std::vector<std::string> Ret;
+  Ret.reserve(Statements.size());
+  for (auto &&X : Statements)
+    Ret.push_back(paramName(*X));
+  return Ret;
+}
+
+bool SequenceAST::isOverloaded(Interpreter *C) const {
+  const auto Generation = C->getDispatchGeneration();
+  const auto Last = Checked.load(std::memory_order_relaxed);
+  if (Last >> 1 == Generation)
+    return Last & 1;
+  const bool Overloaded = C->hasFunction(getFunctionName());
+  Checked.store(Generation << 1 | Overloaded, std::memory_order_relaxed);
+  return Overloaded;
+}
+
+Expected<Value> SequenceAST::eval(Interpreter *C) {
+  if (isOverloaded(C)) {
+    auto Result = Statements.front()->eval(C);
+    for (auto It = Statements.cbegin() + 1; Result && It != Statements.cend();
+         ++It) {
+      auto Next = (*It)->eval(C);
+      if (!Next)
+        return Next;
+      ArgumentList Operands(C->getEvalResource());
+      Operands.reserve(2);
+      Operands.push_back(std::move(*Result));
+      Operands.push_back(std::move(*Next));
+      Result = C->tryCallFunction(getFunctionName(), std::move(Operands));
+    }
+    return Result;
+  }
+  for (auto It = Statements.cbegin(); It != Statements.cend() - 1; ++It) {
+    if (auto V = (*It)->eval(C); !V)
+      return V;
+  }
+  return Statements.back()->eval(C);
+}
+
+namespace {
+
+// Evaluates Args into ArgV, stopping at the first error.
+Expected<Value> evalArgs(Interpreter *C,
+                         const std::vector<std::unique_ptr<AST>> &Args,
+                         ArgumentList &ArgV) {
   ArgV.reserve(Args.size());
-  for (auto &&X : Args)
-    ArgV.push_back(X->eval(C));
-  return C->callFunction(Name, std::move(ArgV));
+  for (auto &&X : Args) {
+    auto V = X->eval(C);
+    if (!V)
+      return V;
+    ArgV.push_back(std::move(*V));
+  }
+  return Value{};
 }
 
-Value LambdaCallExpr::eval(Interpreter *C) {
+} // namespace
+
+Expected<Value> CallExprAST::eval(Interpreter *C) {
+  ArgumentList ArgV(C->getEvalResource());
+  if (auto V = evalArgs(C, Args, ArgV); !V)
+    return V;
+  return C->tryCallFunction(Name, std::move(ArgV));
+}
+
+Expected<Value> LambdaCallExpr::eval(Interpreter *C) {
   auto L = Lambda->eval(C);
-  std::vector<Value> ArgV;
-  ArgV.reserve(Args.size());
-  std::transform(Args.cbegin(), Args.cend(), std::back_inserter(ArgV),
-                 [&](const auto &X) { return X->eval(C); });
-  return invokeForValue(std::any_cast<Function>(L.Data), C, std::move(ArgV));
+  if (!L)
+    return L;
+  ArgumentList ArgV(C->getEvalResource());
+  if (auto V = evalArgs(C, Args, ArgV); !V)
+    return V;
+  const auto F = std::any_cast<Function>(&L->Data);
+  if (!F)
+    return Error{Error::Eval, "Not a function: " + L->Info()};
+  return C->tryCallFunction(*F, std::move(ArgV));
 }
 
-Value IfExprAST::eval(Interpreter *C) {
-  if (Condition->eval(C).booleanof()) {
+Expected<Value> IfExprAST::eval(Interpreter *C) {
+  auto V = Condition->eval(C);
+  if (!V)
+    return V;
+  if (V->booleanof()) {
     return Then->eval(C);
   } else if (Else) {
     return Else->eval(C);
   }
-  return {};
+  return Value{};
+}
+
+Expected<Value> WhileExprAST::eval(Interpreter *C) {
+  Value Ret;
+  while (true) {
+    auto V = Condition->eval(C);
+    if (!V)
+      return V;
+    if (!V->booleanof())
+      return Ret;
+    auto B = Body->eval(C);
+    if (!B)
+      return B;
+    Ret = std::move(*B);
+  }
+}
+
+Expected<Value> TranslationUnitAST::eval(Interpreter *C) {
+  for (std::size_t I = 0; I != ExprList.size(); ++I) {
+    auto V = ExprList[I]->eval(C);
+    if (!V && V.error().Line == 0 && I < Lines.size())
+      V.error().Line = Lines[I];
+    if (!V || I + 1 == ExprList.size())
+      return V;
+  }
+  return Value{};
 }
+
+bool TemporaryScopeAST::isEnabled(Interpreter *C) const {
+  const auto Generation = C->getDispatchGeneration();
+  const auto Last = Checked.load(std::memory_order_relaxed);
+  if (Last >> 1 == Generation)
+    return Last & 1;
+  const bool Enabled =
+      std::all_of(RequiredPure.cbegin(), RequiredPure.cend(),
+                  [&](const std::string &Name) { return C->isPure(Name); });
+  Checked.store(Generation << 1 | Enabled, std::memory_order_relaxed);
+  return Enabled;
+}
+
+Expected<Value> TemporaryScopeAST::eval(Interpreter *C) {
+  if (!isEnabled(C))
+    return Body->eval(C);
+  const auto Guard = C->getTemporaries().enter(this, NSlots);
+  return Body->eval(C);
+}
+
+Expected<Value> TemporaryAST::eval(Interpreter *C) {
+  auto &Temporaries = C->getTemporaries();
+  if (const auto S = Temporaries.find(Scope, Slot); S && S->Ready)
+    return S->V;
+  auto V = Expr->eval(C);
+  if (!V)
+    return V;
+  if (const auto S = Temporaries.find(Scope, Slot)) {
+    S->V = *V;
+    S->Ready = true;
+  }
+  return V;
+}
+
 } // namespace lince
@@ -1,41 +1,105 @@
 #pragma once
-
-#define FMT_STRING_ALIAS 1
-
 #include "ast.hpp"
+#include "astvisitor.hpp"
+#include "nametable.hpp"
 #include "value.hpp"
 
-#include <fmt/format.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <utility>
 #include <vector>
 
 namespace lince {
 
+class Optimizer;
+
 class IdentifierAST : public AST {
   std::string Name;
+  std::size_t Hash;
+
+public:
+  explicit IdentifierAST(std::string Name)
+      : Name(std::move(Name)), Hash(hashName(this->Name)) {}
+
+  Expected<Value> eval(Interpreter *C) final;
 
+  const std::string &getName() const & { return Name; }
+
+  /// The hashName of the name, computed once for every lookup.
+  std::size_t getHash() const noexcept { return Hash; }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
+};
+
+/// Occurrence of a subtree that is shared by every structurally equal
+/// occurrence parsed with the same ASTPool. A shared subtree that reads no
+/// variables is evaluated once per dispatch generation while every
+/// function it calls is pure. Visitors see through to the subtree.
+class SharedAST : public AST {
 public:
-  explicit IdentifierAST(std::string Name) : Name(std::move(Name)) {}
+  /// Result of a shared subtree that reads no variables but calls
+  /// functions.
+  struct Cache {
+    std::vector<std::string> Calls;
+    // Dispatch generation of the last purity check shifted left by one,
+    // with the outcome in the lowest bit.
+    std::atomic<std::uint64_t> Checked{0};
+    std::mutex M;
+    bool HasResult = false;
+    std::uint64_t ResultGeneration = 0;
+    Value Result;
+  };
+
+  struct Node {
+    std::unique_ptr<AST> Expr;
+    /// Set if Expr calls functions but reads no variables.
+    std::unique_ptr<Cache> Cached;
+    /// Whether Expr reads no variables.
+    bool Closed = false;
+  };
+
+private:
+  std::shared_ptr<Node> Target;
+
+  bool isCacheable(Interpreter *C) const;
 
-  Value eval(Interpreter *C) final;
+public:
+  explicit SharedAST(std::shared_ptr<Node> Target) noexcept
+      : Target(std::move(Target)) {}
 
-  std::string dump() const final {
-    return format(fmt("Identifier {{Name: \"{}\"}}"), getName());
+  Expected<Value> eval(Interpreter *C) final;
+
+  const std::shared_ptr<Node> &getNode() const noexcept { return Target; }
+
+  const AST &get() const noexcept { return *Target->Expr; }
+
+  /// \p A, or the subtree it shares if it is a SharedAST.
+  static const AST &unwrap(const AST &A) noexcept {
+    const auto S = dynamic_cast<const SharedAST *>(&A);
+    return S ? S->get() : A;
   }
 
-  const std::string &getName() const & { return Name; }
+  void accept(ASTVisitor &Visitor) const final {
+    Target->Expr->accept(Visitor);
+  }
 };
 
 class GenericCallExpr : public AST {
 public:
-  Value eval(Interpreter *C) { return {{}}; }
+  Expected<Value> eval(Interpreter *C) { return Value{}; }
   virtual std::string getFunctionName() const = 0;
 
   virtual std::vector<std::string> getParams() const = 0;
 };
 
 class UnaryExprAST : public GenericCallExpr {
+  friend class Optimizer;
+
   std::unique_ptr<AST> Operand;
   int Op;
 
@@ -43,24 +107,28 @@ public:
   UnaryExprAST(std::unique_ptr<AST> Operand, int Op) noexcept
       : Operand(std::move(Operand)), Op(Op) {}
 
-  Value eval(Interpreter *C) final;
-
-  std::string dump() const final {
-    return format(fmt("UnaryExpression {{Op: \"{}\",Operand: {}}}"),
-                  reinterpret_cast<const char(&)[]>(Op), Operand->dump());
-  }
+  Expected<Value> eval(Interpreter *C) final;
 
   std::string getFunctionName() const final {
     return std::string("operator") + reinterpret_cast<const char(&)[]>(Op);
   }
 
-  std::vector<std::string> getParams() const final {
-    return {dynamic_cast<const IdentifierAST &>(*Operand).getName()};
-  }
+  std::vector<std::string> getParams() const final;
+
+  int getOp() const noexcept { return Op; }
+
+  const AST &getOperand() const noexcept { return *Operand; }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 class BinExprAST : public GenericCallExpr {
-  std::unique_ptr<AST> LHS, RHS;
+  friend class Optimizer;
+
+  std::unique_ptr<AST> LHS;
+  // Shared with the functions this expression defines, so that it can be
+  // evaluated again, or on several threads at once.
+  std::shared_ptr<AST> RHS;
   int Op;
 
 public:
@@ -68,22 +136,61 @@ public:
              int Op) noexcept
       : LHS(std::move(LHS)), RHS(std::move(RHS)), Op(Op) {}
 
-  Value eval(Interpreter *C) final;
-
-  std::string dump() const final {
-    return format(fmt("BinaryExpression {{Op: \"{}\",LHS: {},RHS: {}}}"),
-                  reinterpret_cast<const char(&)[]>(Op), LHS->dump(),
-                  RHS->dump());
-  }
+  Expected<Value> eval(Interpreter *C) final;
 
   std::string getFunctionName() const final {
     return std::string("operator") + reinterpret_cast<const char(&)[]>(Op);
   }
 
-  std::vector<std::string> getParams() const final {
-    return {dynamic_cast<const IdentifierAST &>(*LHS).getName(),
-            dynamic_cast<const IdentifierAST &>(*RHS).getName()};
+  std::vector<std::string> getParams() const final;
+
+  int getOp() const noexcept { return Op; }
+
+  const AST &getLHS() const noexcept { return *LHS; }
+
+  const AST &getRHS() const noexcept { return *RHS; }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
+};
+
+/// Statements separated by `;`, evaluated in order. The value is that of
+/// the last one, and no function is called, unless a function named
+/// operator; is defined when the sequence starts: defining one opts in to
+/// folding the values of the statements with it from the left, like any
+/// other binary operator.
+class SequenceAST : public GenericCallExpr {
+  friend class Optimizer;
+
+  std::vector<std::unique_ptr<AST>> Statements;
+  // Dispatch generation of the last lookup of operator; shifted left by
+  // one, with the outcome in the lowest bit.
+  mutable std::atomic<std::uint64_t> Checked{0};
+
+  bool isOverloaded(Interpreter *C) const;
+
+public:
+  /// \p Statements must not be empty.
+  explicit SequenceAST(std::vector<std::unique_ptr<AST>> Statements) noexcept
+      : Statements(std::move(Statements)) {
+    assert(!this->Statements.empty() && "empty sequence");
+  }
+
+  /// \p LHS followed by \p RHS. Appends to \p LHS if it is a sequence, so
+  /// that chains stay flat.
+  static std::unique_ptr<AST> append(std::unique_ptr<AST> LHS,
+                                     std::unique_ptr<AST> RHS);
+
+  Expected<Value> eval(Interpreter *C) final;
+
+  std::string getFunctionName() const final { return "operator;"; }
+
+  std::vector<std::string> getParams() const final;
+
+  const std::vector<std::unique_ptr<AST>> &getStatements() const noexcept {
+    return Statements;
   }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 class ConstExprAST : public AST {
@@ -92,25 +199,16 @@ class ConstExprAST : public AST {
 public:
   explicit ConstExprAST(Value V) noexcept : V(std::move(V)) {}
 
-  Value eval(Interpreter *) noexcept final { return V; }
+  Expected<Value> eval(Interpreter *) final { return V; }
 
-  std::string dump() const final {
-    return format(fmt("Constant {{Value: \"{} <{}>\"}}"), V.stringof(),
-                  demangle(V.Data.type().name()));
-  }
-};
+  const Value &getValue() const noexcept { return V; }
 
-template <typename Sequence> inline std::string dumpASTArray(Sequence &&Seq) {
-  std::string S = "[";
-  for (auto &&X : Seq) {
-    S += X->dump() + ',';
-  }
-  S.pop_back();
-  S += ']';
-  return S;
-}
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
+};
 
 class CallExprAST : public GenericCallExpr {
+  friend class Optimizer;
+
   std::string Name;
   std::vector<std::unique_ptr<AST>> Args;
 
@@ -118,19 +216,22 @@ public:
   CallExprAST(std::string Name, std::vector<std::unique_ptr<AST>> Args)
       : Name(std::move(Name)), Args(std::move(Args)) {}
 
-  Value eval(Interpreter *C) final;
-
-  std::string dump() const final {
-    return format(fmt("CallExpression {{Name: \"{}\",Args: {}}}"), Name,
-                  dumpASTArray(Args));
-  }
+  Expected<Value> eval(Interpreter *C) final;
 
   std::vector<std::string> getParams() const final;
 
   std::string getFunctionName() const noexcept final { return Name; }
+
+  const std::vector<std::unique_ptr<AST>> &getArgs() const noexcept {
+    return Args;
+  }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 class LambdaCallExpr : public AST {
+  friend class Optimizer;
+
   std::unique_ptr<AST> Lambda;
   std::vector<std::unique_ptr<AST>> Args;
 
@@ -139,15 +240,20 @@ public:
                  std::vector<std::unique_ptr<AST>> Args)
       : Lambda(std::move(Lambda)), Args(std::move(Args)) {}
 
-  Value eval(Interpreter *C) final;
+  Expected<Value> eval(Interpreter *C) final;
 
-  std::string dump() const final {
-    return format(fmt("LambdaCall {{Lambda: {},Args: {}}}"), Lambda->dump(),
-                  dumpASTArray(Args));
+  const AST &getLambda() const noexcept { return *Lambda; }
+
+  const std::vector<std::unique_ptr<AST>> &getArgs() const noexcept {
+    return Args;
   }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 class IfExprAST : public AST {
+  friend class Optimizer;
+
   std::unique_ptr<AST> Condition, Then, Else;
 
 public:
@@ -156,54 +262,111 @@ public:
       : Condition(std::move(Condition)), Then(std::move(Then)),
         Else(std::move(Else)) {}
 
-  Value eval(Interpreter *C) final;
+  Expected<Value> eval(Interpreter *C) final;
 
-  std::string dump() const final {
-    return format(
-        fmt("IfExpression {{Condition: {},ThenClause: {},ElseClause: {}}}"),
-        Condition->dump(), Then->dump(), Else ? Else->dump() : "nil");
-  }
+  const AST &getCondition() const noexcept { return *Condition; }
+
+  const AST &getThen() const noexcept { return *Then; }
+
+  /// May be null when the expression has no else clause.
+  const AST *getElse() const noexcept { return Else.get(); }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 class WhileExprAST : public AST {
+  friend class Optimizer;
+
   std::unique_ptr<AST> Condition, Body;
 
 public:
   WhileExprAST(std::unique_ptr<AST> Condition, std::unique_ptr<AST> Body)
       : Condition(std::move(Condition)), Body(std::move(Body)) {}
 
-  Value eval(Interpreter *C) final {
-    Value Ret;
-    while (Condition->eval(C).booleanof()) {
-      Ret = Body->eval(C);
-    }
-    return Ret;
-  }
+  Expected<Value> eval(Interpreter *C) final;
 
-  std::string dump() const final {
-    return format(fmt("WhileExpression {{Condition: {}, Body: {}}}"),
-                  Condition->dump(), Body->dump());
-  }
+  const AST &getCondition() const noexcept { return *Condition; }
+
+  const AST &getBody() const noexcept { return *Body; }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 class TranslationUnitAST : public AST {
+  friend class Optimizer;
+
   std::vector<std::unique_ptr<AST>> ExprList;
+  // Source line of each expression, if known.
+  std::vector<std::size_t> Lines;
 
 public:
-  explicit TranslationUnitAST(std::vector<std::unique_ptr<AST>> ExprList = {})
-      : ExprList(std::move(ExprList)) {}
+  /// \p Lines, if not empty, holds the source line of each expression,
+  /// which errors raised while evaluating it report.
+  explicit TranslationUnitAST(std::vector<std::unique_ptr<AST>> ExprList = {},
+                              std::vector<std::size_t> Lines = {})
+      : ExprList(std::move(ExprList)), Lines(std::move(Lines)) {}
 
-  Value eval(Interpreter *C) final {
-    std::for_each(ExprList.begin(), ExprList.end() - 1,
-                  [&](auto &&X) { X->eval(C); });
+  Expected<Value> eval(Interpreter *C) final;
 
-    return ExprList.back()->eval(C);
+  const std::vector<std::unique_ptr<AST>> &getExprList() const noexcept {
+    return ExprList;
   }
 
-  std::string dump() const final {
-    return format(fmt("TranslationUnitAST {{ExpressionList: {}}}"),
-                  dumpASTArray(ExprList));
+  const std::vector<std::size_t> &getLines() const noexcept { return Lines; }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
+};
+
+/// Evaluates its body with fresh slots for the TemporaryAST nodes the
+/// optimizer put inside it. The slots are only used while every function
+/// in getRequiredPure() is pure; otherwise each temporary is evaluated
+/// every time, like the expression it replaced.
+class TemporaryScopeAST : public AST {
+  friend class Optimizer;
+
+  std::shared_ptr<AST> Body;
+  std::size_t NSlots = 0;
+  std::vector<std::string> RequiredPure;
+  // Dispatch generation of the last purity check shifted left by one, with
+  // the outcome in the lowest bit.
+  mutable std::atomic<std::uint64_t> Checked{0};
+
+  bool isEnabled(Interpreter *C) const;
+
+public:
+  Expected<Value> eval(Interpreter *C) final;
+
+  const AST &getBody() const noexcept { return *Body; }
+
+  std::size_t getSlotCount() const noexcept { return NSlots; }
+
+  const std::vector<std::string> &getRequiredPure() const noexcept {
+    return RequiredPure;
   }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
+};
+
+/// Expression evaluated at most once per evaluation of its scope.
+class TemporaryAST : public AST {
+  friend class Optimizer;
+
+  std::shared_ptr<AST> Expr;
+  const TemporaryScopeAST *Scope;
+  std::size_t Slot;
+
+public:
+  TemporaryAST(std::shared_ptr<AST> Expr, const TemporaryScopeAST *Scope,
+               std::size_t Slot) noexcept
+      : Expr(std::move(Expr)), Scope(Scope), Slot(Slot) {}
+
+  Expected<Value> eval(Interpreter *C) final;
+
+  const AST &getExpression() const noexcept { return *Expr; }
+
+  std::size_t getSlot() const noexcept { return Slot; }
+
+  void accept(ASTVisitor &Visitor) const final { Visitor.visit(*this); }
 };
 
 } // namespace lince
@@ -0,0 +1,205 @@
+#include "astpool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <vector>
+
+namespace lince {
+
+namespace {
+
+void combine(std::size_t &Hash, std::size_t X) noexcept {
+  Hash ^= X + 0x9e3779b97f4a7c15 + (Hash << 6) + (Hash >> 2);
+}
+
+template <typename T> std::size_t bitsOf(const T &X) noexcept {
+  std::size_t Bits = 0;
+  std::memcpy(&Bits, &X, std::min(sizeof(T), sizeof(Bits)));
+  return Bits;
+}
+
+// Hashes V into Hash. Returns false for values that no literal produces.
+bool hashValue(const Value &V, std::size_t &Hash) {
+  const auto &Type = V.Data.type();
+  combine(Hash, Type.hash_code());
+  if (!V.Data.has_value())
+    return true;
+  if (Type == typeid(bool))
+    combine(Hash, std::any_cast<bool>(V.Data));
+  else if (Type == typeid(int))
+    combine(Hash, bitsOf(std::any_cast<int>(V.Data)));
+  else if (Type == typeid(long long))
+    combine(Hash, bitsOf(std::any_cast<long long>(V.Data)));
+  else if (Type == typeid(double))
+    combine(Hash, bitsOf(std::any_cast<double>(V.Data)));
+  else if (Type == typeid(String))
+    combine(Hash, std::hash<std::string_view>()(
+                      std::any_cast<const String &>(V.Data).view()));
+  else
+    return false;
+  return true;
+}
+
+// Whether two literals are the same. Doubles are compared bitwise, so that
+// 0.0 and -0.0 stay apart.
+bool sameValue(const Value &A, const Value &B) {
+  const auto &Type = A.Data.type();
+  if (Type != B.Data.type())
+    return false;
+  if (!A.Data.has_value())
+    return true;
+  if (Type == typeid(bool))
+    return std::any_cast<bool>(A.Data) == std::any_cast<bool>(B.Data);
+  if (Type == typeid(int))
+    return std::any_cast<int>(A.Data) == std::any_cast<int>(B.Data);
+  if (Type == typeid(long long))
+    return std::any_cast<long long>(A.Data) ==
+           std::any_cast<long long>(B.Data);
+  if (Type == typeid(double))
+    return bitsOf(std::any_cast<double>(A.Data)) ==
+           bitsOf(std::any_cast<double>(B.Data));
+  return std::any_cast<const String &>(A.Data).view() ==
+         std::any_cast<const String &>(B.Data).view();
+}
+
+const SharedAST::Node *nodeOf(const AST &A) noexcept {
+  const auto S = dynamic_cast<const SharedAST *>(&A);
+  return S ? S->getNode().get() : nullptr;
+}
+
+std::string operatorName(int Op) {
+  return std::string("operator") + static_cast<char>(Op);
+}
+
+// What interning a node needs to know about it.
+struct Shape {
+  std::size_t Hash = 0;
+  bool Closed = true;
+  std::vector<std::string> Calls;
+
+  // Adds a child. Returns false unless it was interned.
+  bool add(const AST &A) {
+    const auto N = nodeOf(A);
+    if (!N)
+      return false;
+    combine(Hash, std::hash<const void *>()(N));
+    Closed = Closed && N->Closed;
+    if (N->Cached)
+      Calls.insert(Calls.end(), N->Cached->Calls.cbegin(),
+                   N->Cached->Calls.cend());
+    return true;
+  }
+};
+
+// Describes A. Returns false if A cannot be shared.
+bool describe(const AST &A, Shape &S) {
+  combine(S.Hash, typeid(A).hash_code());
+  if (const auto I = dynamic_cast<const IdentifierAST *>(&A)) {
+    combine(S.Hash, I->getHash());
+    S.Closed = false;
+    return true;
+  }
+  if (const auto C = dynamic_cast<const ConstExprAST *>(&A))
+    return hashValue(C->getValue(), S.Hash);
+  if (const auto U = dynamic_cast<const UnaryExprAST *>(&A)) {
+    combine(S.Hash, U->getOp());
+    S.Calls.push_back(operatorName(U->getOp()));
+    return S.add(U->getOperand());
+  }
+  if (const auto B = dynamic_cast<const BinExprAST *>(&A)) {
+    if (B->getOp() == '=')
+      return false;
+    combine(S.Hash, B->getOp());
+    S.Calls.push_back(operatorName(B->getOp()));
+    return S.add(B->getLHS()) && S.add(B->getRHS());
+  }
+  if (const auto C = dynamic_cast<const CallExprAST *>(&A)) {
+    combine(S.Hash, std::hash<std::string>()(C->getFunctionName()));
+    S.Calls.push_back(C->getFunctionName());
+    return std::all_of(C->getArgs().cbegin(), C->getArgs().cend(),
+                       [&](const auto &X) { return S.add(*X); });
+  }
+  return false;
+}
+
+// Whether A and B, which were described, are the same subtree. Their
+// children are, if they are the same nodes.
+bool sameShape(const AST &A, const AST &B) {
+  if (typeid(A) != typeid(B))
+    return false;
+  if (const auto I = dynamic_cast<const IdentifierAST *>(&A))
+    return I->getName() == static_cast<const IdentifierAST &>(B).getName();
+  if (const auto C = dynamic_cast<const ConstExprAST *>(&A))
+    return sameValue(C->getValue(),
+                     static_cast<const ConstExprAST &>(B).getValue());
+  if (const auto U = dynamic_cast<const UnaryExprAST *>(&A)) {
+    const auto &V = static_cast<const UnaryExprAST &>(B);
+    return U->getOp() == V.getOp() &&
+           nodeOf(U->getOperand()) == nodeOf(V.getOperand());
+  }
+  if (const auto L = dynamic_cast<const BinExprAST *>(&A)) {
+    const auto &R = static_cast<const BinExprAST &>(B);
+    return L->getOp() == R.getOp() &&
+           nodeOf(L->getLHS()) == nodeOf(R.getLHS()) &&
+           nodeOf(L->getRHS()) == nodeOf(R.getRHS());
+  }
+  const auto &L = static_cast<const CallExprAST &>(A).getArgs();
+  const auto &R = static_cast<const CallExprAST &>(B).getArgs();
+  return static_cast<const CallExprAST &>(A).getFunctionName() ==
+             static_cast<const CallExprAST &>(B).getFunctionName() &&
+         std::equal(L.cbegin(), L.cend(), R.cbegin(), R.cend(),
+                    [](const auto &X, const auto &Y) {
+                      return nodeOf(*X) == nodeOf(*Y);
+                    });
+}
+
+} // namespace
+
+std::unique_ptr<AST> ASTPool::intern(std::unique_ptr<AST> A) {
+  if (!A || nodeOf(*A))
+    return A;
+  Shape S;
+  if (!describe(*A, S))
+    return A;
+
+  std::lock_guard<std::mutex> Lock(M);
+  const auto [First, Last] = Table.equal_range(S.Hash);
+  for (auto It = First; It != Last; ++It) {
+    if (auto N = It->second.lock(); N && sameShape(*N->Expr, *A))
+      return std::make_unique<SharedAST>(std::move(N));
+  }
+
+  auto N = std::make_shared<SharedAST::Node>();
+  N->Expr = std::move(A);
+  N->Closed = S.Closed;
+  if (S.Closed && !S.Calls.empty()) {
+    std::sort(S.Calls.begin(), S.Calls.end());
+    S.Calls.erase(std::unique(S.Calls.begin(), S.Calls.end()), S.Calls.end());
+    N->Cached = std::make_unique<SharedAST::Cache>();
+    N->Cached->Calls = std::move(S.Calls);
+  }
+  Table.emplace(S.Hash, N);
+
+  // Drop the entries of subtrees that were freed, whenever the table has
+  // doubled since the last time.
+  if (Table.size() >= PurgeAt) {
+    for (auto It = Table.begin(); It != Table.end();)
+      It = It->second.expired() ? Table.erase(It) : std::next(It);
+    PurgeAt = std::max<std::size_t>(1024, Table.size() * 2);
+  }
+  return std::make_unique<SharedAST>(std::move(N));
+}
+
+std::size_t ASTPool::size() {
+  std::lock_guard<std::mutex> Lock(M);
+  return std::count_if(Table.cbegin(), Table.cend(), [](const auto &Entry) {
+    return !Entry.second.expired();
+  });
+}
+
+} // namespace lince
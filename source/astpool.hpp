@@ -0,0 +1,35 @@
+#pragma once
+#include "astimpl.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace lince {
+
+/// Subtrees parsed so far, so that structurally equal variable reads,
+/// literals and expressions built from them are stored once however often
+/// they occur. Parsers may share a pool across threads.
+///
+/// The pool only refers to the subtrees weakly: a subtree is freed with
+/// the last expression using it.
+class ASTPool {
+  std::mutex M;
+  // Keyed by the hash of the kind, operator or name and constant of a
+  // node and the nodes of its children.
+  std::unordered_multimap<std::size_t, std::weak_ptr<SharedAST::Node>> Table;
+  std::size_t PurgeAt = 1024;
+
+public:
+  /// The SharedAST for the subtree equal to \p A, made from \p A if there
+  /// is none yet. Returns \p A itself unless it is a variable read, a
+  /// constant, or a unary, binary or call expression whose operands were
+  /// interned already; assignments and sequences are never shared.
+  std::unique_ptr<AST> intern(std::unique_ptr<AST> A);
+
+  /// Number of distinct subtrees in the pool that are still in use.
+  std::size_t size();
+};
+
+} // namespace lince
@@ -0,0 +1,246 @@
+#include "astprinter.hpp"
+#include "astimpl.hpp"
+
+#include <vector>
+
+namespace lince {
+
+namespace {
+
+class ASTPrinter : public ASTVisitor {
+  fmt::memory_buffer &Out;
+  PrintStyle Style;
+  int Depth = 0;
+  // Whether the innermost open object or array has no element yet.
+  std::vector<bool> First;
+
+  void write(std::string_view S) { Out.append(S.data(), S.data() + S.size()); }
+
+  void write(char C) { Out.push_back(C); }
+
+  void newline() {
+    if (Style != PrintStyle::Tree)
+      return;
+    write('\n');
+    for (int I = 0; I != Depth; ++I)
+      write(' ');
+  }
+
+  void separator() {
+    if (!First.back())
+      write(',');
+    First.back() = false;
+    newline();
+  }
+
+  void quoted(std::string_view S) {
+    write('"');
+    if (Style != PrintStyle::JSON) {
+      write(S);
+    } else {
+      for (char C : S) {
+        if (C == '"' || C == '\\') {
+          write('\\');
+          write(C);
+        } else if (static_cast<unsigned char>(C) < 0x20) {
+          fmt::format_to(std::back_inserter(Out), "\\u{:04x}",
+                         static_cast<unsigned>(C));
+        } else {
+          write(C);
+        }
+      }
+    }
+    write('"');
+  }
+
+  void beginObject(std::string_view Kind) {
+    if (Style == PrintStyle::JSON) {
+      write("{\"Kind\":");
+      quoted(Kind);
+      First.push_back(false);
+    } else {
+      write(Kind);
+      write(" {");
+      First.push_back(true);
+    }
+    ++Depth;
+  }
+
+  void endObject() {
+    --Depth;
+    First.pop_back();
+    newline();
+    write('}');
+  }
+
+  void key(std::string_view Name) {
+    separator();
+    if (Style == PrintStyle::JSON) {
+      quoted(Name);
+      write(':');
+    } else {
+      write(Name);
+      write(": ");
+    }
+  }
+
+  void op(int Op) {
+    key("Op");
+    const char C = static_cast<char>(Op);
+    quoted(std::string_view(&C, 1));
+  }
+
+  void node(std::string_view Name, const AST &A) {
+    key(Name);
+    A.accept(*this);
+  }
+
+  void list(std::string_view Name, const std::vector<std::unique_ptr<AST>> &L) {
+    key(Name);
+    write('[');
+    First.push_back(true);
+    ++Depth;
+    for (auto &&X : L) {
+      separator();
+      X->accept(*this);
+    }
+    --Depth;
+    First.pop_back();
+    if (!L.empty())
+      newline();
+    write(']');
+  }
+
+  void constant(const Value &V) {
+    const auto Type = demangle(V.Data.type().name());
+    if (Style != PrintStyle::JSON) {
+      key("Value");
+      quoted(V.stringof() + " <" + Type + '>');
+      return;
+    }
+
+    key("Value");
+    const auto &T = V.Data.type();
+    if (T == typeid(String))
+      quoted(valueCast<std::string>(V));
+    else if (!V.Data.has_value())
+      write("null");
+    else if (T == typeid(int) || T == typeid(long long) ||
+             T == typeid(double) || T == typeid(bool))
+      write(V.stringof());
+    else
+      quoted(V.stringof());
+    key("Type");
+    quoted(Type);
+  }
+
+public:
+  ASTPrinter(fmt::memory_buffer &Out, PrintStyle Style)
+      : Out(Out), Style(Style) {}
+
+  void visit(const IdentifierAST &A) final {
+    beginObject("Identifier");
+    key("Name");
+    quoted(A.getName());
+    endObject();
+  }
+
+  void visit(const UnaryExprAST &A) final {
+    beginObject("UnaryExpression");
+    op(A.getOp());
+    node("Operand", A.getOperand());
+    endObject();
+  }
+
+  void visit(const BinExprAST &A) final {
+    beginObject("BinaryExpression");
+    op(A.getOp());
+    node("LHS", A.getLHS());
+    node("RHS", A.getRHS());
+    endObject();
+  }
+
+  void visit(const SequenceAST &A) final {
+    beginObject("Sequence");
+    list("Statements", A.getStatements());
+    endObject();
+  }
+
+  void visit(const ConstExprAST &A) final {
+    beginObject("Constant");
+    constant(A.getValue());
+    endObject();
+  }
+
+  void visit(const CallExprAST &A) final {
+    beginObject("CallExpression");
+    key("Name");
+    quoted(A.getFunctionName());
+    list("Args", A.getArgs());
+    endObject();
+  }
+
+  void visit(const LambdaCallExpr &A) final {
+    beginObject("LambdaCall");
+    node("Lambda", A.getLambda());
+    list("Args", A.getArgs());
+    endObject();
+  }
+
+  void visit(const IfExprAST &A) final {
+    beginObject("IfExpression");
+    node("Condition", A.getCondition());
+    node("ThenClause", A.getThen());
+    if (A.getElse()) {
+      node("ElseClause", *A.getElse());
+    } else {
+      key("ElseClause");
+      write(Style == PrintStyle::JSON ? "null" : "nil");
+    }
+    endObject();
+  }
+
+  void visit(const WhileExprAST &A) final {
+    beginObject("WhileExpression");
+    node("Condition", A.getCondition());
+    node("Body", A.getBody());
+    endObject();
+  }
+
+  void visit(const TranslationUnitAST &A) final {
+    beginObject("TranslationUnitAST");
+    list("ExpressionList", A.getExprList());
+    endObject();
+  }
+
+  void visit(const TemporaryScopeAST &A) final {
+    beginObject("TemporaryScope");
+    key("Slots");
+    write(std::to_string(A.getSlotCount()));
+    node("Body", A.getBody());
+    endObject();
+  }
+
+  void visit(const TemporaryAST &A) final {
+    beginObject("Temporary");
+    key("Slot");
+    write(std::to_string(A.getSlot()));
+    node("Expression", A.getExpression());
+    endObject();
+  }
+};
+
+} // namespace
+
+void printAST(const AST &A, fmt::memory_buffer &Out, PrintStyle Style) {
+  ASTPrinter P(Out, Style);
+  A.accept(P);
+}
+
+std::string AST::dump() const {
+  fmt::memory_buffer Out;
+  printAST(*this, Out, PrintStyle::Compact);
+  return fmt::to_string(Out);
+}
+
+} // namespace lince
@@ -0,0 +1,18 @@
+#pragma once
+#include "ast.hpp"
+
+#include <fmt/format.h>
+
+namespace lince {
+
+enum class PrintStyle {
+  Tree,    ///< One field per line, indented by depth.
+  Compact, ///< The tree layout on a single line.
+  JSON     ///< A JSON object per node, on a single line.
+};
+
+/// Writes \p A into \p Out in a single pass over the tree.
+void printAST(const AST &A, fmt::memory_buffer &Out,
+              PrintStyle Style = PrintStyle::Tree);
+
+} // namespace lince
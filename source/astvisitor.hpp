@@ -0,0 +1,36 @@
+#pragma once
+
+namespace lince {
+
+class IdentifierAST;
+class UnaryExprAST;
+class BinExprAST;
+class SequenceAST;
+class ConstExprAST;
+class CallExprAST;
+class LambdaCallExpr;
+class IfExprAST;
+class WhileExprAST;
+class TranslationUnitAST;
+class TemporaryScopeAST;
+class TemporaryAST;
+
+class ASTVisitor {
+public:
+  virtual ~ASTVisitor() = default;
+
+  virtual void visit(const IdentifierAST &) = 0;
+  virtual void visit(const UnaryExprAST &) = 0;
+  virtual void visit(const BinExprAST &) = 0;
+  virtual void visit(const SequenceAST &) = 0;
+  virtual void visit(const ConstExprAST &) = 0;
+  virtual void visit(const CallExprAST &) = 0;
+  virtual void visit(const LambdaCallExpr &) = 0;
+  virtual void visit(const IfExprAST &) = 0;
+  virtual void visit(const WhileExprAST &) = 0;
+  virtual void visit(const TranslationUnitAST &) = 0;
+  virtual void visit(const TemporaryScopeAST &) = 0;
+  virtual void visit(const TemporaryAST &) = 0;
+};
+
+} // namespace lince
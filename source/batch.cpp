@@ -0,0 +1,331 @@
+#define FMT_STRING_ALIAS 1
+
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "stdlib.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Lines of input whose first byte falls in the same block of this size are
+// evaluated together, as one chunk.
+constexpr std::size_t ChunkBytes = 1 << 16;
+
+// Chunks that may be evaluated ahead of the first one not yet written.
+constexpr std::size_t ReorderWindow = 1024;
+
+// The input, mapped into memory if it is a regular file and read into a
+// buffer otherwise.
+class Input {
+  int FD = -1;
+  void *Map = MAP_FAILED;
+  std::size_t Size = 0;
+  std::string Buffer;
+
+  void readAll() {
+    std::vector<char> Block(1 << 20);
+    ssize_t N;
+    while ((N = ::read(FD, Block.data(), Block.size())) > 0)
+      Buffer.append(Block.data(), N);
+    if (N < 0)
+      throw std::runtime_error("Cannot read input");
+  }
+
+public:
+  explicit Input(const char *Path) {
+    FD = Path == std::string_view("-") ? STDIN_FILENO : ::open(Path, O_RDONLY);
+    if (FD < 0)
+      throw std::runtime_error(std::string("Cannot open ") + Path);
+    struct stat S;
+    if (::fstat(FD, &S) == 0 && S_ISREG(S.st_mode) && S.st_size > 0) {
+      Size = S.st_size;
+      Map = ::mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+    }
+    if (Map != MAP_FAILED)
+      ::madvise(Map, Size, MADV_SEQUENTIAL);
+    else
+      readAll();
+  }
+
+  Input(const Input &) = delete;
+  Input &operator=(const Input &) = delete;
+
+  ~Input() {
+    if (Map != MAP_FAILED)
+      ::munmap(Map, Size);
+    if (FD > STDIN_FILENO)
+      ::close(FD);
+  }
+
+  std::string_view data() const noexcept {
+    return Map != MAP_FAILED
+               ? std::string_view(static_cast<const char *>(Map), Size)
+               : std::string_view(Buffer);
+  }
+};
+
+// Histogram of latencies in nanoseconds, with 8 buckets per power of two.
+class LatencyHistogram {
+  static constexpr unsigned SubBuckets = 8;
+  std::array<std::uint64_t, 64 * SubBuckets> Count{};
+  std::uint64_t Max = 0;
+
+  static unsigned bucketOf(std::uint64_t NS) noexcept {
+    if (NS < SubBuckets)
+      return NS;
+    unsigned Log = 63 - __builtin_clzll(NS);
+    return (Log - 2) * SubBuckets + ((NS >> (Log - 3)) & (SubBuckets - 1));
+  }
+
+  // Largest latency recorded in bucket B.
+  static std::uint64_t upperBound(unsigned B) noexcept {
+    if (B < SubBuckets)
+      return B;
+    const unsigned Log = B / SubBuckets + 2;
+    const std::uint64_t Sub = B % SubBuckets + SubBuckets;
+    return ((Sub + 1) << (Log - 3)) - 1;
+  }
+
+public:
+  void add(std::uint64_t NS) noexcept {
+    ++Count[bucketOf(NS)];
+    Max = std::max(Max, NS);
+  }
+
+  LatencyHistogram &operator+=(const LatencyHistogram &Other) noexcept {
+    for (std::size_t I = 0; I != Count.size(); ++I)
+      Count[I] += Other.Count[I];
+    Max = std::max(Max, Other.Max);
+    return *this;
+  }
+
+  std::uint64_t total() const noexcept {
+    std::uint64_t N = 0;
+    for (const auto C : Count)
+      N += C;
+    return N;
+  }
+
+  /// Latency below which a fraction \p P of the samples fall, rounded up
+  /// to the bucket boundary.
+  std::uint64_t percentile(double P) const noexcept {
+    const auto Rank = static_cast<std::uint64_t>(P * total());
+    std::uint64_t Seen = 0;
+    for (unsigned B = 0; B != Count.size(); ++B) {
+      Seen += Count[B];
+      if (Seen > Rank)
+        return std::min(upperBound(B), Max);
+    }
+    return Max;
+  }
+
+  std::uint64_t max() const noexcept { return Max; }
+};
+
+// Results of the chunks, written in input order. Chunk K can be stored
+// once every chunk up to K - ReorderWindow has been written.
+class ReorderBuffer {
+  std::mutex M;
+  std::condition_variable Stored, Written;
+  std::vector<std::optional<std::string>> Slots;
+  std::size_t Next = 0;
+
+public:
+  ReorderBuffer() : Slots(ReorderWindow) {}
+
+  // Blocks until chunk K fits into the window.
+  void waitForRoom(std::size_t K) {
+    std::unique_lock<std::mutex> Lock(M);
+    Written.wait(Lock, [&] { return K < Next + Slots.size(); });
+  }
+
+  void store(std::size_t K, std::string Output) {
+    {
+      std::lock_guard<std::mutex> Lock(M);
+      Slots[K % Slots.size()] = std::move(Output);
+    }
+    Stored.notify_all();
+  }
+
+  // Takes the output of chunk Next, blocking until it is stored.
+  std::string takeNext() {
+    std::unique_lock<std::mutex> Lock(M);
+    auto &Slot = Slots[Next % Slots.size()];
+    Stored.wait(Lock, [&] { return Slot.has_value(); });
+    auto Output = std::move(*Slot);
+    Slot.reset();
+    ++Next;
+    Lock.unlock();
+    Written.notify_all();
+    return Output;
+  }
+};
+
+struct WorkerStats {
+  std::uint64_t Errors = 0;
+  LatencyHistogram Latency;
+};
+
+// Start of the first line that starts at or after Offset.
+std::size_t lineStart(std::string_view Data, std::size_t Offset) {
+  if (Offset == 0 || Offset >= Data.size())
+    return std::min(Offset, Data.size());
+  const auto NL = Data.find('\n', Offset - 1);
+  return NL == std::string_view::npos ? Data.size() : NL + 1;
+}
+
+// Evaluates one line in a scope of its own, so that lines cannot see each
+// other's variables and functions.
+void evalLine(lince::Interpreter &I, std::string_view Line,
+              std::string &Output, WorkerStats &Stats) {
+  if (!Line.empty() && Line.back() == '\r')
+    Line.remove_suffix(1);
+  const auto Start = Clock::now();
+  try {
+    auto Scope = I.createScope();
+    if (auto AST = I.parse(std::string(Line))) {
+      lince::optimize(AST);
+      lince::Value V;
+      I.eval(AST.get(), V);
+      Output += V.Info();
+    }
+  } catch (std::exception &E) {
+    ++Stats.Errors;
+    Output += E.what();
+  }
+  Stats.Latency.add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           Start)
+          .count());
+  Output += '\n';
+}
+
+void work(std::string_view Data, std::size_t NChunks,
+          std::atomic<std::size_t> &NextChunk, ReorderBuffer &Buffer,
+          WorkerStats &Stats) {
+  lince::Interpreter I;
+  I.addModule(lince::StdLibModule());
+  for (std::size_t K; (K = NextChunk.fetch_add(1)) < NChunks;) {
+    Buffer.waitForRoom(K);
+    const auto End = lineStart(Data, (K + 1) * ChunkBytes);
+    std::string Output;
+    // Lines written by the input go before its result, in input order.
+    lince::LineOutput Lines(Output);
+    for (auto Pos = lineStart(Data, K * ChunkBytes); Pos < End;) {
+      const auto NL = std::min(Data.find('\n', Pos), End);
+      evalLine(I, Data.substr(Pos, NL - Pos), Output, Stats);
+      Pos = NL + 1;
+    }
+    Buffer.store(K, std::move(Output));
+  }
+}
+
+std::string formatNanoseconds(std::uint64_t NS) {
+  if (NS < 1000)
+    return fmt::format(fmt("{}ns"), NS);
+  if (NS < 1000000)
+    return fmt::format(fmt("{:.1f}us"), NS / 1e3);
+  return fmt::format(fmt("{:.1f}ms"), NS / 1e6);
+}
+
+int run(const char *Path, unsigned Threads) {
+  const Input In(Path);
+  const auto Data = In.data();
+  const std::size_t NChunks = (Data.size() + ChunkBytes - 1) / ChunkBytes;
+  std::atomic<std::size_t> NextChunk{0};
+  ReorderBuffer Buffer;
+  std::vector<WorkerStats> Stats(Threads);
+
+  const auto Start = Clock::now();
+  std::vector<std::thread> Workers;
+  for (unsigned T = 0; T != Threads; ++T)
+    Workers.emplace_back(work, Data, NChunks, std::ref(NextChunk),
+                         std::ref(Buffer), std::ref(Stats[T]));
+  for (std::size_t K = 0; K != NChunks; ++K) {
+    const auto Output = Buffer.takeNext();
+    std::fwrite(Output.data(), 1, Output.size(), stdout);
+  }
+  for (auto &W : Workers)
+    W.join();
+  std::fflush(stdout);
+  const std::chrono::duration<double> Elapsed = Clock::now() - Start;
+
+  WorkerStats Total;
+  for (const auto &S : Stats) {
+    Total.Errors += S.Errors;
+    Total.Latency += S.Latency;
+  }
+  const auto Lines = Total.Latency.total();
+  print(stderr,
+        fmt("{} lines ({} failed) in {:.3f}s on {} threads: {:.0f} lines/s, "
+            "{:.1f} MB/s\n"),
+        Lines, Total.Errors, Elapsed.count(), Threads,
+        Lines / Elapsed.count(), Data.size() / 1e6 / Elapsed.count());
+  print(stderr, fmt("latency: p50 {} p90 {} p99 {} p99.9 {} max {}\n"),
+        formatNanoseconds(Total.Latency.percentile(0.5)),
+        formatNanoseconds(Total.Latency.percentile(0.9)),
+        formatNanoseconds(Total.Latency.percentile(0.99)),
+        formatNanoseconds(Total.Latency.percentile(0.999)),
+        formatNanoseconds(Total.Latency.max()));
+  return Total.Errors ? 1 : 0;
+}
+
+int usage(const char *Program) {
+  print(stderr,
+        fmt("usage: {} [--threads=N] FILE\n"
+            "Evaluates each line of FILE, or of the standard input if FILE "
+            "is -,\n"
+            "and prints the results in order.\n"),
+        Program);
+  return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  unsigned Threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *Path = nullptr;
+  for (int I = 1; I < argc; ++I) {
+    const std::string_view Arg = argv[I];
+    if (Arg.substr(0, 10) == "--threads=") {
+      Threads = std::atoi(argv[I] + 10);
+      if (Threads == 0)
+        return usage(argv[0]);
+    } else if (!Path) {
+      Path = argv[I];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (!Path)
+    return usage(argv[0]);
+
+  try {
+    return run(Path, Threads);
+  } catch (std::exception &E) {
+    print(stderr, fmt("{}\n"), E.what());
+    return 1;
+  }
+}
@@ -0,0 +1,288 @@
+#include "datafile.hpp"
+#include "exceptions.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+namespace lince {
+
+namespace {
+
+// Text files are parsed in chunks of about this many bytes, each ending at
+// a line end.
+constexpr std::size_t ChunkBytes = 1 << 22;
+
+// Columns are reduced in chunks of this many elements.
+constexpr std::size_t ChunkElements = 1 << 20;
+
+// Runs Body(K) for every K in [0, N), on up to one thread per core. Idle
+// threads take the next K. If any call throws, the error of the smallest
+// K that failed is rethrown once all threads are done.
+template <typename Fn> void parallelFor(std::size_t N, Fn Body) {
+  const auto NThreads = std::min<std::size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), N);
+  std::atomic<std::size_t> Next{0};
+  std::atomic<bool> Failed{false};
+  std::vector<std::exception_ptr> Errors(N);
+
+  const auto Run = [&] {
+    while (!Failed.load(std::memory_order_relaxed)) {
+      const auto K = Next.fetch_add(1, std::memory_order_relaxed);
+      if (K >= N)
+        return;
+      try {
+        Body(K);
+      } catch (...) {
+        Errors[K] = std::current_exception();
+        Failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> Threads;
+  try {
+    for (std::size_t I = 1; I < NThreads; ++I)
+      Threads.emplace_back(Run);
+  } catch (...) {
+    Failed = true;
+    for (auto &T : Threads)
+      T.join();
+    throw;
+  }
+  Run();
+  for (auto &T : Threads)
+    T.join();
+
+  for (const auto &E : Errors) {
+    if (E)
+      std::rethrow_exception(E);
+  }
+}
+
+struct Mapping {
+  std::shared_ptr<const void> Owner;
+  const char *Data = nullptr;
+  std::size_t Size = 0;
+};
+
+// Maps the file at Path for reading from start to end. An empty file
+// gives an empty mapping.
+Mapping mapFile(const std::string &Path) {
+  const int FD = ::open(Path.c_str(), O_RDONLY);
+  if (FD < 0)
+    throw EvalError("Cannot open " + Path);
+  struct stat St;
+  if (::fstat(FD, &St) != 0 || !S_ISREG(St.st_mode)) {
+    ::close(FD);
+    throw EvalError("Not a regular file: " + Path);
+  }
+  Mapping M;
+  M.Size = St.st_size;
+  if (M.Size == 0) {
+    ::close(FD);
+    return M;
+  }
+  void *Addr = ::mmap(nullptr, M.Size, PROT_READ, MAP_PRIVATE, FD, 0);
+  ::close(FD);
+  if (Addr == MAP_FAILED)
+    throw EvalError("Cannot map " + Path);
+  ::madvise(Addr, M.Size, MADV_SEQUENTIAL);
+  M.Data = static_cast<const char *>(Addr);
+  M.Owner = std::shared_ptr<const void>(
+      Addr, [Size = M.Size](const void *P) {
+        ::munmap(const_cast<void *>(P), Size);
+      });
+  return M;
+}
+
+// Start of the first line that starts at or after Offset.
+std::size_t lineStart(std::string_view Text, std::size_t Offset) {
+  if (Offset == 0 || Offset >= Text.size())
+    return std::min(Offset, Text.size());
+  const auto NL = Text.find('\n', Offset - 1);
+  return NL == std::string_view::npos ? Text.size() : NL + 1;
+}
+
+std::size_t lineNumber(std::string_view Text, std::size_t Offset) {
+  return 1 + std::count(Text.begin(), Text.begin() + Offset, '\n');
+}
+
+bool isBlank(char C) { return C == ' ' || C == '\t' || C == '\r'; }
+
+// Appends the fields of Line to Row. Returns false if one is not a number.
+bool parseRow(std::string_view Line, std::vector<double> &Row) {
+  const char *P = Line.data();
+  const char *const End = P + Line.size();
+  const auto SkipBlanks = [&] {
+    while (P != End && isBlank(*P))
+      ++P;
+  };
+  SkipBlanks();
+  while (P != End) {
+    double X;
+    const auto [Next, EC] = std::from_chars(P, End, X);
+    if (EC != std::errc())
+      return false;
+    Row.push_back(X);
+    P = Next;
+    SkipBlanks();
+    if (P != End && (*P == ',' || *P == ';')) {
+      ++P;
+      SkipBlanks();
+      if (P == End)
+        return false;
+    } else if (P == Next && P != End) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Fields of the lines of one chunk of a text file.
+struct ParsedChunk {
+  std::vector<std::vector<double>> Fields;
+};
+
+void parseChunk(const std::string &Path, std::string_view Text,
+                std::size_t Begin, std::size_t End, bool First,
+                ParsedChunk &Out) {
+  std::vector<double> Row;
+  for (auto Pos = Begin; Pos < End;) {
+    const auto NL = std::min(Text.find('\n', Pos), End);
+    const auto Line = Text.substr(Pos, NL - Pos);
+    const auto LinePos = Pos;
+    Pos = NL + 1;
+
+    const auto Start = std::find_if_not(Line.begin(), Line.end(), isBlank);
+    if (Start == Line.end() || *Start == '#')
+      continue;
+    Row.clear();
+    if (!parseRow(Line, Row)) {
+      // A header is only allowed before the first row of the file.
+      if (std::exchange(First, false))
+        continue;
+      throw EvalError(Path + ":" +
+                      std::to_string(lineNumber(Text, LinePos)) +
+                      ": not a number");
+    }
+    First = false;
+    if (Out.Fields.empty())
+      Out.Fields.resize(Row.size());
+    if (Row.size() != Out.Fields.size())
+      throw EvalError(Path + ":" +
+                      std::to_string(lineNumber(Text, LinePos)) +
+                      ": expected " + std::to_string(Out.Fields.size()) +
+                      " fields");
+    for (std::size_t I = 0; I != Row.size(); ++I)
+      Out.Fields[I].push_back(Row[I]);
+  }
+}
+
+// Folds the elements of each chunk of C with Op, starting from Init.
+template <typename Fn>
+std::vector<double> reduceChunks(const Column &C, double Init, Fn Op) {
+  std::vector<double> Partial((C.size() + ChunkElements - 1) / ChunkElements,
+                              Init);
+  parallelFor(Partial.size(), [&](std::size_t K) {
+    const auto First = K * ChunkElements;
+    const auto Last = std::min(First + ChunkElements, C.size());
+    Partial[K] = C.visit([&](auto Load) {
+      double Acc = Init;
+      for (auto I = First; I != Last; ++I)
+        Acc = Op(Acc, static_cast<double>(Load(I)));
+      return Acc;
+    });
+  });
+  return Partial;
+}
+
+} // namespace
+
+Column mapColumn(const std::string &Path, Column::ElementType Type,
+                 std::size_t Fields, std::size_t Field) {
+  if (Fields == 0 || Field >= Fields)
+    throw EvalError("No field " + std::to_string(Field) + " in records of " +
+                    std::to_string(Fields));
+  const auto M = mapFile(Path);
+  const auto Record = Fields * Column::sizeOf(Type);
+  if (M.Size % Record != 0)
+    throw EvalError(Path + " is not made of " + std::to_string(Record) +
+                    "-byte records");
+  const auto Offset = M.Size ? Field * Column::sizeOf(Type) : 0;
+  return {M.Owner, M.Data + Offset, M.Size / Record, Record, Type};
+}
+
+std::vector<Column> readTable(const std::string &Path) {
+  const auto M = mapFile(Path);
+  const std::string_view Text(M.Data, M.Size);
+
+  std::vector<ParsedChunk> Chunks((M.Size + ChunkBytes - 1) / ChunkBytes);
+  parallelFor(Chunks.size(), [&](std::size_t K) {
+    parseChunk(Path, Text, lineStart(Text, K * ChunkBytes),
+               lineStart(Text, (K + 1) * ChunkBytes), K == 0, Chunks[K]);
+  });
+
+  std::size_t NFields = 0;
+  for (std::size_t K = 0; K != Chunks.size(); ++K) {
+    const auto N = Chunks[K].Fields.size();
+    if (N != 0 && NFields != 0 && N != NFields)
+      throw EvalError(Path + ":" +
+                      std::to_string(lineNumber(
+                          Text, lineStart(Text, K * ChunkBytes))) +
+                      ": rows have " + std::to_string(NFields) + " fields");
+    NFields = std::max(NFields, N);
+  }
+
+  // Each chunk's numbers are freed as soon as they have been copied.
+  std::vector<Column> Columns;
+  for (std::size_t I = 0; I != NFields; ++I) {
+    std::size_t Size = 0;
+    for (const auto &C : Chunks)
+      Size += C.Fields.empty() ? 0 : C.Fields[I].size();
+    std::vector<double> Numbers;
+    Numbers.reserve(Size);
+    for (auto &C : Chunks) {
+      if (C.Fields.empty())
+        continue;
+      Numbers.insert(Numbers.end(), C.Fields[I].cbegin(), C.Fields[I].cend());
+      std::vector<double>().swap(C.Fields[I]);
+    }
+    Columns.emplace_back(std::move(Numbers));
+  }
+  return Columns;
+}
+
+double sum(const Column &C) {
+  double Sum = 0;
+  for (const auto X : reduceChunks(C, 0, std::plus<>()))
+    Sum += X;
+  return Sum;
+}
+
+double min(const Column &C) {
+  if (C.size() == 0)
+    throw EvalError("Minimum of an empty column");
+  const auto Partial = reduceChunks(
+      C, C.number(0), [](double X, double Y) { return std::min(X, Y); });
+  return *std::min_element(Partial.cbegin(), Partial.cend());
+}
+
+double max(const Column &C) {
+  if (C.size() == 0)
+    throw EvalError("Maximum of an empty column");
+  const auto Partial = reduceChunks(
+      C, C.number(0), [](double X, double Y) { return std::max(X, Y); });
+  return *std::max_element(Partial.cbegin(), Partial.cend());
+}
+
+} // namespace lince
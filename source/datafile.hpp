@@ -0,0 +1,34 @@
+#pragma once
+#include "value.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace lince {
+
+/// Maps the file at \p Path, made of records of \p Fields numbers of type
+/// \p Type in native byte order, and returns field \p Field of every
+/// record without copying it. Throws an EvalError if the file cannot be
+/// mapped or is not made of whole records.
+Column mapColumn(const std::string &Path, Column::ElementType Type,
+                 std::size_t Fields = 1, std::size_t Field = 0);
+
+/// Parses the text file at \p Path into one column of doubles per field.
+/// Fields are separated by blanks or by a comma or semicolon; every line
+/// must have as many as the first. Blank lines, lines starting with '#'
+/// and a first line that is not numeric, such as a CSV header, are
+/// skipped. The file is split into chunks that are parsed in parallel.
+std::vector<Column> readTable(const std::string &Path);
+
+/// Sum of the elements of \p C, as doubles. Large columns are summed in
+/// parallel, in chunks that only depend on the size of the column, so
+/// the result does not depend on the number of cores.
+double sum(const Column &C);
+
+/// Smallest and largest element of \p C. Throws an EvalError if \p C is
+/// empty.
+double min(const Column &C);
+double max(const Column &C);
+
+} // namespace lince
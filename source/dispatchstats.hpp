@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace lince {
+
+#ifdef SKENA_DISPATCH_STATS
+inline constexpr bool CountDispatch = true;
+#else
+/// Whether the interpreter counts how calls are dispatched. Set by building
+/// with SKENA_DISPATCH_STATS; otherwise the counting compiles to nothing.
+inline constexpr bool CountDispatch = false;
+#endif
+
+/// How often each path of Interpreter::callFunction was taken.
+struct DispatchCounters {
+  std::uint64_t ExactMatch = 0; ///< An overload took the arguments as is.
+  std::uint64_t Converted = 0;  ///< One overload was reachable by conversion.
+  std::uint64_t Conversions = 0;     ///< Arguments converted for those.
+  std::uint64_t Ambiguous = 0;       ///< Several were; the call failed.
+  std::uint64_t DynamicFallback = 0; ///< A function taking only Values.
+  std::uint64_t NoMatch = 0;
+
+  std::uint64_t calls() const noexcept {
+    return ExactMatch + Converted + Ambiguous + DynamicFallback + NoMatch;
+  }
+
+  DispatchCounters &operator+=(const DispatchCounters &Other) noexcept {
+    ExactMatch += Other.ExactMatch;
+    Converted += Other.Converted;
+    Conversions += Other.Conversions;
+    Ambiguous += Other.Ambiguous;
+    DynamicFallback += Other.DynamicFallback;
+    NoMatch += Other.NoMatch;
+    return *this;
+  }
+};
+
+/// Snapshot of the dispatch counters of an interpreter.
+struct DispatchStats {
+  /// Calls by function name.
+  std::map<std::string, DispatchCounters> Functions;
+
+  /// Variable reads by the number of scopes searched to find the variable:
+  /// element 1 counts variables found in the innermost scope.
+  std::vector<std::uint64_t> ScopesSearched;
+
+  /// Variable reads not found in any scope.
+  std::uint64_t ScopeMisses = 0;
+
+  DispatchCounters total() const noexcept {
+    DispatchCounters Sum;
+    for (const auto &Pair : Functions)
+      Sum += Pair.second;
+    return Sum;
+  }
+};
+
+} // namespace lince
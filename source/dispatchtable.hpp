@@ -0,0 +1,126 @@
+#pragma once
+#include "module.hpp"
+#include "value.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace lince {
+
+/// Flattened overload sets of an interpreter, kept up to date as functions
+/// and scopes come and go. Each name maps to one contiguous array of
+/// candidates, innermost scope first and native modules last, so that
+/// resolving a call is a hash lookup followed by a linear scan.
+///
+/// Names only defined by a single native module have no entry; their
+/// candidates are read from the module directly.
+class DispatchTable {
+  struct Entry {
+    std::vector<Function> Candidates;
+    // Scope depth of each candidate that comes from a scope. Native
+    // candidates follow these in Candidates.
+    std::vector<std::size_t> Depth;
+  };
+
+  std::unordered_map<std::string, Entry> Overloads;
+  // Names of the functions of every native module.
+  std::unordered_set<std::string_view> NativeNames;
+  std::uint64_t Generation = 0;
+
+  // Generations are drawn from one counter, so that two tables only share
+  // a generation if one is an unchanged copy of the other.
+  static std::uint64_t nextGeneration() noexcept {
+    static std::atomic<std::uint64_t> Counter{0};
+    return ++Counter;
+  }
+
+  using ModuleList = std::vector<const NativeModule *>;
+
+  static void resetNatives(Entry &E, const std::string &Name,
+                           const ModuleList &Modules) {
+    E.Candidates.erase(E.Candidates.cbegin() + E.Depth.size(),
+                       E.Candidates.cend());
+    for (auto M = Modules.crbegin(); M != Modules.crend(); ++M) {
+      for (const auto &F : (*M)->getOverloads(Name))
+        E.Candidates.push_back(F);
+    }
+  }
+
+public:
+  /// Identifies the current contents of the table.
+  std::uint64_t getGeneration() const noexcept { return Generation; }
+
+  /// Records \p F as defined in the scope at \p Depth. It follows every
+  /// function defined earlier in the same scope.
+  void add(const std::string &Name, std::size_t Depth, const Function &F,
+           const ModuleList &Modules) {
+    auto [It, Inserted] = Overloads.try_emplace(Name);
+    auto &E = It->second;
+    if (Inserted) {
+      E.Candidates.push_back(F);
+      E.Depth.push_back(Depth);
+      resetNatives(E, Name, Modules);
+    } else {
+      const auto Pos = std::find_if(E.Depth.cbegin(), E.Depth.cend(),
+                                    [&](std::size_t D) { return D < Depth; }) -
+                       E.Depth.cbegin();
+      E.Candidates.insert(E.Candidates.cbegin() + Pos, F);
+      E.Depth.insert(E.Depth.cbegin() + Pos, Depth);
+    }
+    Generation = nextGeneration();
+  }
+
+  /// Forgets one function named \p Name defined in the scope at \p Depth.
+  void remove(const std::string &Name, std::size_t Depth) {
+    const auto It = Overloads.find(Name);
+    if (It == Overloads.end())
+      return;
+    auto &E = It->second;
+    const auto Pos = std::find(E.Depth.cbegin(), E.Depth.cend(), Depth) -
+                     E.Depth.cbegin();
+    if (Pos == static_cast<std::ptrdiff_t>(E.Depth.size()))
+      return;
+    E.Candidates.erase(E.Candidates.cbegin() + Pos);
+    E.Depth.erase(E.Depth.cbegin() + Pos);
+    Generation = nextGeneration();
+  }
+
+  /// Rebuilds the native candidates of the names defined by the module
+  /// appended to \p Modules; the others are unchanged. Names defined by
+  /// several modules get an entry so their candidates stay contiguous;
+  /// this loads the lazy modules defining them.
+  void addNatives(const ModuleList &Modules) {
+    Modules.back()->forEachFunctionName([&](std::string_view Name) {
+      const bool Shared = !NativeNames.insert(Name).second;
+      std::string Key(Name);
+      auto It = Overloads.find(Key);
+      if (It == Overloads.end()) {
+        if (!Shared)
+          return;
+        It = Overloads.try_emplace(std::move(Key)).first;
+      }
+      resetNatives(It->second, It->first, Modules);
+    });
+    Generation = nextGeneration();
+  }
+
+  /// Every candidate for \p Name, innermost first.
+  FunctionRange lookup(const std::string &Name,
+                       const ModuleList &Modules) const {
+    if (const auto It = Overloads.find(Name); It != Overloads.cend())
+      return FunctionRange(It->second.Candidates);
+    for (auto M = Modules.crbegin(); M != Modules.crend(); ++M) {
+      if (auto R = (*M)->getOverloads(Name); !R.empty())
+        return R;
+    }
+    return {};
+  }
+};
+
+} // namespace lince
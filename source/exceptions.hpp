@@ -1,10 +1,33 @@
 #pragma once
 
+#include <cstddef>
 #include <exception>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace lince {
 
+/// Why an evaluation failed, and where.
+struct Error {
+  enum ErrorKind { Eval, Parse };
+
+  ErrorKind Kind = Eval;
+  std::string Message;
+  /// Line of the script statement being evaluated, or 0 if unknown.
+  std::size_t Line = 0;
+  /// Functions that were being called, innermost first.
+  std::vector<std::string> CallStack;
+
+  Error() = default;
+
+  Error(ErrorKind Kind, std::string Message)
+      : Kind(Kind), Message(std::move(Message)) {}
+
+  /// Throws this error as a ParseError or an EvalError.
+  [[noreturn]] void raise() &&;
+};
+
 class ParseError : public std::exception {
   std::string Msg;
 
@@ -15,12 +38,24 @@ public:
 };
 
 class EvalError : public std::exception {
-  std::string Msg;
+  Error Details;
 
 public:
-  explicit EvalError(std::string Msg) : Msg(std::move(Msg)) {}
+  explicit EvalError(std::string Msg) : Details(Error::Eval, std::move(Msg)) {}
 
-  const char *what() const noexcept override { return Msg.c_str(); }
+  explicit EvalError(Error Details) noexcept : Details(std::move(Details)) {}
+
+  const char *what() const noexcept override {
+    return Details.Message.c_str();
+  }
+
+  const Error &getError() const noexcept { return Details; }
 };
 
-} // namespace lince
\ No newline at end of file
+[[noreturn]] inline void Error::raise() && {
+  if (Kind == Parse)
+    throw ParseError(std::move(Message));
+  throw EvalError(std::move(*this));
+}
+
+} // namespace lince
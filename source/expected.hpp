@@ -0,0 +1,53 @@
+#pragma once
+#include "exceptions.hpp"
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace lince {
+
+/// A \p T, or the Error that prevented computing it. The evaluator and
+/// the dispatcher pass errors up as values, which costs a branch instead
+/// of unwinding the stack; get() turns them into exceptions where they
+/// leave the interpreter.
+///
+/// \p T must be default-constructible. The error is held by pointer so
+/// that a successful result is hardly larger than a \p T.
+template <typename T> class [[nodiscard]] Expected {
+  T Val{};
+  std::unique_ptr<Error> Err;
+
+public:
+  Expected(const T &V) : Val(V) {}
+
+  Expected(T &&V) noexcept(std::is_nothrow_move_constructible_v<T>)
+      : Val(std::move(V)) {}
+
+  Expected(Error E) : Err(std::make_unique<Error>(std::move(E))) {}
+
+  Expected(std::unique_ptr<Error> E) noexcept : Err(std::move(E)) {}
+
+  explicit operator bool() const noexcept { return !Err; }
+
+  T &operator*() &noexcept { return Val; }
+  const T &operator*() const &noexcept { return Val; }
+  T &&operator*() &&noexcept { return std::move(Val); }
+  T *operator->() noexcept { return &Val; }
+  const T *operator->() const noexcept { return &Val; }
+
+  Error &error() noexcept { return *Err; }
+  const Error &error() const noexcept { return *Err; }
+
+  /// Gives up the error, so that it can be returned from the caller.
+  std::unique_ptr<Error> takeError() noexcept { return std::move(Err); }
+
+  /// The value. Throws the error if there is one.
+  T get() && {
+    if (Err)
+      std::move(*Err).raise();
+    return std::move(Val);
+  }
+};
+
+} // namespace lince
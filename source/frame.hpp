@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+
+namespace lince {
+
+/// Scope whose bindings may be shared by several interpreters. Copying a
+/// frame is O(1); the bindings are copied the first time a frame that is
+/// still shared is written to.
+///
+/// Sharing is decided from the reference count, so an interpreter that
+/// has been forked must not be written to while another thread copies it.
+///
+/// \p Map is an allocator-aware container such as a NameTable. Its memory,
+/// and the frame's own, comes from the resource given by the writer that
+/// allocated or copied it.
+template <typename Map> class Frame {
+  std::shared_ptr<Map> Ptr;
+
+  using Allocator = std::pmr::polymorphic_allocator<Map>;
+
+public:
+  Frame() noexcept = default;
+
+  /// Copies the bindings of \p M into memory from \p R.
+  Frame(const Map &M, std::pmr::memory_resource *R)
+      : Ptr(std::allocate_shared<Map>(Allocator(R), M)) {}
+
+  const Map &get() const noexcept {
+    static const Map Empty;
+    return Ptr ? *Ptr : Empty;
+  }
+
+  /// The bindings for writing. Allocates them from \p R if there are none
+  /// yet, and copies them into \p R if they are shared.
+  Map &mut(std::pmr::memory_resource *R) {
+    if (!Ptr)
+      Ptr = std::allocate_shared<Map>(Allocator(R));
+    else if (Ptr.use_count() > 1)
+      Ptr = std::allocate_shared<Map>(Allocator(R), *Ptr);
+    return *Ptr;
+  }
+
+  bool isShared() const noexcept { return Ptr && Ptr.use_count() > 1; }
+};
+
+} // namespace lince
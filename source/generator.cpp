@@ -0,0 +1,64 @@
+#include "generator.hpp"
+#include "interpreter.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace lince {
+
+Generator makeGenerator(std::function<Generator::Pipeline::Cursor()> Source) {
+  auto P = std::make_shared<Generator::Pipeline>();
+  P->Source = std::move(Source);
+  return Generator(std::move(P));
+}
+
+Generator addStage(const Generator &G, Generator::Pipeline::Stage S) {
+  auto P = std::make_shared<Generator::Pipeline>(G.pipeline());
+  P->Stages.push_back(std::move(S));
+  return Generator(std::move(P));
+}
+
+void forEach(Interpreter &I, const Generator &G,
+             const std::function<bool(Value &)> &Fn) {
+  using Stage = Generator::Pipeline::Stage;
+  const auto &Stages = G.pipeline().Stages;
+
+  // Values each Take stage still passes on. A stage that passes nothing
+  // ends the traversal before the source is read.
+  std::vector<long long> Remaining;
+  for (const auto &S : Stages) {
+    if (S.K == Stage::Take && S.N <= 0)
+      return;
+    Remaining.push_back(S.N);
+  }
+
+  const auto Call = [&](const Value &F, Value Arg) {
+    ArgumentList Args(I.getEvalResource());
+    Args.push_back(std::move(Arg));
+    return I.callFunction(valueCast<Function>(F), std::move(Args));
+  };
+
+  auto Next = G.pipeline().Source();
+  Value V;
+  while (Next(I, V)) {
+    bool Keep = true;
+    bool Last = false;
+    for (std::size_t K = 0; Keep && K != Stages.size(); ++K) {
+      switch (Stages[K].K) {
+      case Stage::Map:
+        V = Call(Stages[K].F, std::move(V));
+        break;
+      case Stage::Filter:
+        Keep = Call(Stages[K].F, V).booleanof();
+        break;
+      case Stage::Take:
+        Last |= --Remaining[K] == 0;
+        break;
+      }
+    }
+    if ((Keep && !Fn(V)) || Last)
+      return;
+  }
+}
+
+} // namespace lince
@@ -0,0 +1,42 @@
+#pragma once
+#include "value.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace lince {
+
+/// Source and stages of a Generator. Traversals run every stage on each
+/// value before reading the next one, so a pipeline needs no storage for
+/// the values in between.
+struct Generator::Pipeline {
+  /// Reads the next value of one traversal of the source into its second
+  /// argument. Returns false once the source is exhausted.
+  using Cursor = std::function<bool(Interpreter &, Value &)>;
+
+  struct Stage {
+    enum Kind : std::uint8_t { Map, Filter, Take };
+
+    Kind K;
+    Value F;         ///< Function applied by Map or tested by Filter.
+    long long N = 0; ///< Number of values Take passes on.
+  };
+
+  /// Starts a traversal of the source.
+  std::function<Cursor()> Source;
+  std::vector<Stage> Stages;
+};
+
+/// Generator of the values of \p Source, without stages.
+Generator makeGenerator(std::function<Generator::Pipeline::Cursor()> Source);
+
+/// \p G followed by the stage \p S.
+Generator addStage(const Generator &G, Generator::Pipeline::Stage S);
+
+/// Calls \p Fn with every value of \p G, until it returns false. Map and
+/// filter stages call their functions through \p I.
+void forEach(Interpreter &I, const Generator &G,
+             const std::function<bool(Value &)> &Fn);
+
+} // namespace lince
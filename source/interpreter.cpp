@@ -1,67 +1,217 @@
 #include "interpreter.hpp"
 #include "ast.hpp"
+#include "astimpl.hpp"
+#include "astpool.hpp"
 #include "demangle.hpp"
 #include "parser.hpp"
 
 #include <algorithm>
+#include <optional>
+#include <thread>
 #include <typeindex>
 #include <typeinfo>
 
 namespace lince {
 
 void Interpreter::eval(AST *MyAST, Value &Result) {
-  Result = MyAST->eval(this);
+  const EvalGuard Guard(*this);
+  Result = MyAST->eval(this).get();
 }
 
 std::unique_ptr<AST> Interpreter::parse(const std::string &Expr) const {
-  Parser P{std::istringstream{Expr}};
+  Parser P(Expr, Pool.get());
   return P();
 }
 
+void Interpreter::setHashConsing(bool Enable) {
+  if (!Enable)
+    Pool.reset();
+  else if (!Pool)
+    Pool = std::make_shared<ASTPool>();
+}
+
+namespace {
+
+// Scripts smaller than this are parsed on the calling thread only.
+constexpr std::size_t ParallelParseThreshold = 1 << 16;
+
+struct Statement {
+  std::string_view Text;
+  std::size_t Line;
+};
+
+// Splits a script at line breaks that are neither inside parentheses nor
+// inside a string literal.
+std::vector<Statement> splitStatements(std::string_view Source) {
+  std::vector<Statement> Ret;
+  std::size_t Start = 0, StartLine = 1, Line = 1;
+  int Depth = 0;
+  char Quote = 0;
+  for (std::size_t I = 0; I != Source.size(); ++I) {
+    const char C = Source[I];
+    if (C == '\n')
+      ++Line;
+    if (Quote) {
+      if (C == Quote && Source[I - 1] != '\\')
+        Quote = 0;
+    } else if (C == '"' || C == '\'') {
+      Quote = C;
+    } else if (C == '(') {
+      ++Depth;
+    } else if (C == ')') {
+      Depth = std::max(Depth - 1, 0);
+    } else if (C == '\n' && Depth == 0) {
+      Ret.push_back({Source.substr(Start, I - Start), StartLine});
+      Start = I + 1;
+      StartLine = Line;
+    }
+  }
+  Ret.push_back({Source.substr(Start), StartLine});
+  return Ret;
+}
+
+} // namespace
+
+std::unique_ptr<AST> Interpreter::parseScript(const std::string &Source,
+                                              unsigned Threads) const {
+  const auto Statements = splitStatements(Source);
+  const auto N = Statements.size();
+  std::vector<std::unique_ptr<AST>> Parsed(N);
+
+  if (Threads == 0)
+    Threads = Source.size() < ParallelParseThreshold
+                  ? 1
+                  : std::max(1u, std::thread::hardware_concurrency());
+  Threads = std::min<std::size_t>(Threads, N);
+
+  // Each thread parses a contiguous range and stops at its first error.
+  std::vector<std::optional<std::pair<std::size_t, std::string>>> Errors(
+      Threads);
+  const auto Work = [&](unsigned T) {
+    for (auto I = N * T / Threads, End = N * (T + 1) / Threads; I != End;
+         ++I) {
+      try {
+        Parsed[I] = Parser(Statements[I].Text, Pool.get())();
+      } catch (std::exception &E) {
+        Errors[T].emplace(I, E.what());
+        return;
+      }
+    }
+  };
+
+  std::vector<std::thread> Workers;
+  for (unsigned T = 1; T < Threads; ++T)
+    Workers.emplace_back(Work, T);
+  Work(0);
+  for (auto &W : Workers)
+    W.join();
+
+  for (const auto &E : Errors) {
+    if (E)
+      throw ParseError("line " + std::to_string(Statements[E->first].Line) +
+                       ": " + E->second);
+  }
+
+  std::vector<std::unique_ptr<AST>> ExprList;
+  std::vector<std::size_t> Lines;
+  for (std::size_t I = 0; I != N; ++I) {
+    if (!Parsed[I])
+      continue;
+    ExprList.push_back(std::move(Parsed[I]));
+    Lines.push_back(Statements[I].Line);
+  }
+  if (ExprList.empty())
+    return nullptr;
+  return std::make_unique<TranslationUnitAST>(std::move(ExprList),
+                                              std::move(Lines));
+}
+
 const Function &Interpreter::addLocalFunction(const std::string &Name,
                                               Function Func) {
-  auto It = FunctionNS.back().emplace(Name, std::move(Func));
+  auto It = FunctionNS.back()
+                .mut(scopeResource(FunctionNS.size() - 1))
+                .emplace(Name, std::move(Func));
+  boundFunction(Name, It->second, FunctionNS.size() - 1);
   return It->second;
 }
 
 std::set<std::string>
 Interpreter::getCompletionList(const std::string &Text) const {
   std::set<std::string> Ret;
+  const auto Add = [&](std::string_view Name) {
+    if (Name.length() != Text.length())
+      Ret.emplace(Name);
+  };
 
-  for (const auto &Scope : ValueNS) {
-    for (const auto &Pair : Scope) {
-      if (Pair.first.find(Text) == 0 && Pair.first.length() != Text.length())
-        Ret.insert(Pair.first);
-    }
-  }
-  for (const auto &Scope : FunctionNS) {
-    for (const auto &Pair : Scope) {
-      if (Pair.first.find(Text) == 0 && Pair.first.length() != Text.length())
-        Ret.insert(Pair.first);
-    }
+  Symbols.forEachWithPrefix(Text, [&](std::string_view Name, int N) {
+    if (N + (BaseSymbols ? BaseSymbols->count(Name) : 0) > 0)
+      Add(Name);
+  });
+  if (BaseSymbols) {
+    BaseSymbols->forEachWithPrefix(Text, [&](std::string_view Name, int N) {
+      if (N + Symbols.count(Name) > 0)
+        Add(Name);
+    });
   }
+  for (const auto M : NativeModules)
+    M->forEachNameWithPrefix(Text, Add);
   return Ret;
 }
 
-const Value *Interpreter::findVariable(const std::string &Name) const noexcept {
+const Value *Interpreter::findVariable(const std::string &Name,
+                                       std::size_t Hash) const {
   for (auto Scope = ValueNS.crbegin(); Scope != ValueNS.crend(); ++Scope) {
-    const auto V = Scope->find(Name);
-    if (V != Scope->cend())
-      return &V->second;
+    const auto &Vars = Scope->get();
+    const auto V = Vars.find(Name, Hash);
+    if (V == Vars.cend())
+      continue;
+    if constexpr (CountDispatch) {
+      const std::size_t Searched = Scope - ValueNS.crbegin() + 1;
+      if (Counts.ScopesSearched.size() <= Searched)
+        Counts.ScopesSearched.resize(Searched + 1);
+      ++Counts.ScopesSearched[Searched];
+    }
+    return &V->second;
+  }
+  if constexpr (CountDispatch)
+    ++Counts.ScopeMisses;
+  for (auto M = NativeModules.crbegin(); M != NativeModules.crend(); ++M) {
+    if (const auto V = (*M)->findValue(Name))
+      return V;
   }
   return nullptr;
 }
 
-auto Interpreter::findFunctions(const std::string &Name) const noexcept
-    -> std::vector<std::reference_wrapper<const Function>> {
-  std::vector<std::reference_wrapper<const Function>> Ret;
-  std::for_each(
-      FunctionNS.crbegin(), FunctionNS.crend(), [&](const auto &Scope) {
-        auto [Begin, End] = Scope.equal_range(Name);
-        std::for_each(Begin, End,
-                      [&](const auto &Pair) { Ret.emplace_back(Pair.second); });
-      });
-  return Ret;
+DispatchStats Interpreter::getDispatchStats() const {
+  DispatchStats S;
+  S.Functions.insert(Counts.Functions.cbegin(), Counts.Functions.cend());
+  S.ScopesSearched = Counts.ScopesSearched;
+  S.ScopeMisses = Counts.ScopeMisses;
+  return S;
+}
+
+void Interpreter::mergeDispatchStats(const Interpreter &Fork) {
+  if constexpr (!CountDispatch)
+    return;
+  for (const auto &[Name, C] : Fork.Counts.Functions)
+    Counts.Functions[Name] += C;
+  const auto &Searched = Fork.Counts.ScopesSearched;
+  if (Counts.ScopesSearched.size() < Searched.size())
+    Counts.ScopesSearched.resize(Searched.size());
+  for (std::size_t I = 0; I != Searched.size(); ++I)
+    Counts.ScopesSearched[I] += Searched[I];
+  Counts.ScopeMisses += Fork.Counts.ScopeMisses;
+}
+
+Value *Interpreter::findScopeVariable(const std::string &Name,
+                                      std::size_t Hash) {
+  for (auto Scope = ValueNS.rbegin(); Scope != ValueNS.rend(); ++Scope) {
+    if (Scope->get().find(Name, Hash) == Scope->get().end())
+      continue;
+    auto &Vars = Scope->mut(scopeResource(ValueNS.rend() - Scope - 1));
+    return &Vars.find(Name, Hash)->second;
+  }
+  return nullptr;
 }
 
 } // namespace lince
@@ -1,21 +1,33 @@
 #pragma once
 #include "ast.hpp"
+#include "dispatchstats.hpp"
+#include "dispatchtable.hpp"
 #include "exceptions.hpp"
+#include "memory.hpp"
 #include "module.hpp"
+#include "nametable.hpp"
+#include "symbolindex.hpp"
+#include "temporaries.hpp"
 #include "value.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <numeric>
 #include <set>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
 namespace lince {
 
+class ASTPool;
+
 class Interpreter : public ModuleBase<Interpreter> {
   friend class ModuleBase<Interpreter>;
 
@@ -25,64 +37,361 @@ public:
 
     explicit ScopeGuard(Interpreter *C) noexcept : I(C) {}
 
-    ~ScopeGuard() {
-      I->ValueNS.pop_back();
-      I->FunctionNS.pop_back();
+    ~ScopeGuard() { I->popScope(); }
+  };
+
+  /// Marks an evaluation while it lives. Scopes pushed and arguments passed
+  /// during the outermost one are allocated from an arena released when it
+  /// ends, and the names bound in those scopes are not indexed for
+  /// completion. eval() makes one; so must code that calls functions on a
+  /// fork.
+  class EvalGuard {
+    Interpreter &I;
+
+  public:
+    explicit EvalGuard(Interpreter &I) noexcept : I(I) {
+      if (I.EvalDepth++ == 0)
+        I.PersistentScopes = I.ValueNS.size();
+    }
+
+    EvalGuard(const EvalGuard &) = delete;
+    EvalGuard &operator=(const EvalGuard &) = delete;
+
+    ~EvalGuard() {
+      if (--I.EvalDepth != 0)
+        return;
+      I.PersistentScopes = std::numeric_limits<std::size_t>::max();
+      I.EvalPool.release();
+      I.EvalArena.release();
     }
   };
 
+  /// Allocates the scopes and call arguments of the interpreter from
+  /// \p Upstream.
+  explicit Interpreter(
+      std::pmr::memory_resource *Upstream = std::pmr::get_default_resource())
+      : Memory(std::make_shared<AccountingResource>(Upstream)) {
+    pushScope();
+  }
+
+  Interpreter(const Interpreter &) = delete;
+  Interpreter &operator=(const Interpreter &) = delete;
+
+  /// Creates an interpreter that shares every scope of this one in O(1).
+  /// Scopes are copied when first written to, and the fork gets a fresh
+  /// innermost scope, so neither interpreter sees the other's later
+  /// assignments or definitions.
+  ///
+  /// The fork accounts its memory to this interpreter. A fork made while
+  /// this interpreter evaluates must not outlive that evaluation.
+  Interpreter fork() const {
+    freezeSymbols();
+    return Interpreter(*this, ForkTag{});
+  }
+
   ScopeGuard createScope() {
-    ValueNS.emplace_back();
-    FunctionNS.emplace_back();
+    pushScope();
     return ScopeGuard(this);
   }
 
   std::unique_ptr<AST> parse(const std::string &Expr) const;
 
+  /// Makes parse and parseScript share equal subtrees, across calls and
+  /// with forks made afterwards, instead of building each occurrence.
+  /// Closed pure subtrees are then evaluated once per set of functions,
+  /// but the optimizer no longer rewrites inside shared subtrees.
+  void setHashConsing(bool Enable);
+
+  /// The pool of shared subtrees, or null unless hash-consing is on.
+  ASTPool *getASTPool() const noexcept { return Pool.get(); }
+
+  /// Parses a script into a single TranslationUnitAST. Expressions are
+  /// separated by line breaks outside of parentheses and string literals.
+  /// Returns null if the script has no expressions.
+  ///
+  /// Expressions are parsed on \p Threads threads; 0 picks one thread for
+  /// small scripts and one per core for large ones. Errors are reported
+  /// for the first failing expression in source order.
+  std::unique_ptr<AST> parseScript(const std::string &Source,
+                                   unsigned Threads = 0) const;
+
+  /// Evaluates \p MyAST. Memory for call scopes and arguments comes from
+  /// an arena that is released when the outermost evaluation returns.
   void eval(AST *MyAST, Value &Result);
 
-  Value getValue(const std::string &Name) const {
-    if (auto V = findVariable(Name))
+  const Value &getValue(const std::string &Name) const {
+    if (auto V = findVariable(Name, hashName(Name)))
       return *V;
     throw EvalError("No such variable: " + Name);
   }
 
+  /// Reads the variable \p Name or, if there is none, the function \p Name
+  /// as a value. Overloaded functions cannot be read as values. \p Hash is
+  /// the hashName of \p Name.
+  Value getValueOrFunction(const std::string &Name, std::size_t Hash) const {
+    return tryGetValueOrFunction(Name, Hash).get();
+  }
+
+  /// Same as getValueOrFunction, but returns the error instead of throwing.
+  Expected<Value>
+  tryGetValueOrFunction(const std::string &Name, std::size_t Hash) const {
+    if (auto V = findVariable(Name, Hash))
+      return *V;
+    const auto Candidates = findFunctions(Name);
+    if (Candidates.empty())
+      return Error{Error::Eval, "No such variable: " + Name};
+    if (Candidates.end() - Candidates.begin() > 1)
+      return Error{Error::Eval, "Ambiguous function value: " + Name};
+    return Value{*Candidates.begin()};
+  }
+
   const Value &setValue(const std::string &Name, Value V) {
-    if (auto Var = findVariable(Name))
-      return const_cast<Value &>(*Var) = std::move(V);
-    return ValueNS.back()[Name] = std::move(V);
+    return setValue(Name, hashName(Name), std::move(V));
+  }
+
+  /// Same as setValue(Name, V), where \p Hash is the hashName of \p Name.
+  const Value &setValue(const std::string &Name, std::size_t Hash, Value V) {
+    if (auto Var = findScopeVariable(Name, Hash))
+      return *Var = std::move(V);
+    return addLocalValue(Name, std::move(V));
   }
 
   const Value &addLocalValue(const std::string &Name, Value V) {
-    return ValueNS.back()[Name] = std::move(V);
+    auto [It, Inserted] =
+        ValueNS.back().mut(scopeResource(ValueNS.size() - 1)).try_emplace(Name);
+    if (Inserted)
+      bound(Name, ValueNS.size() - 1);
+    return It->second = std::move(V);
   }
 
   template <typename Sequence>
   Function const &getFunction(const std::string &Name,
                               Sequence const &Type) const &;
 
+  /// The function named \p Name whose signature is \p Type, or null.
+  template <typename Sequence>
+  const Function *findFunction(const std::string &Name,
+                               const Sequence &Type) const;
+
   const Function &addLocalFunction(const std::string &Name, Function Func);
 
+  /// Calls the function named \p Name. Outside an evaluation, the call is
+  /// one.
   template <typename Sequence>
-  Value callFunction(const std::string &Name, Sequence &&Args);
+  Value callFunction(const std::string &Name, Sequence &&Args) {
+    const EvalGuard Guard(*this);
+    return tryCallFunction(Name, std::forward<Sequence>(Args)).get();
+  }
+
+  /// Calls the function value \p F, converting arguments whose type
+  /// differs from the parameter type. Outside an evaluation, the call is
+  /// one.
+  Value callFunction(const Function &F, ArgumentList Args) {
+    const EvalGuard Guard(*this);
+    return tryCallFunction(F, std::move(Args)).get();
+  }
+
+  /// Same as callFunction, but returns errors instead of throwing them.
+  /// Errors raised by a function called by name list it in their call
+  /// stack.
+  template <typename Sequence>
+  Expected<Value> tryCallFunction(const std::string &Name, Sequence &&Args);
+
+  Expected<Value> tryCallFunction(const Function &F, ArgumentList Args);
 
   std::set<std::string> getCompletionList(const std::string &Text) const;
 
   template <typename ModuleImpl> void addModule(ModuleBase<ModuleImpl> &&M) {
-    FunctionNS.emplace_back(std::move(M).getFunctionNS());
-    ValueNS.emplace_back(std::move(M).getValueNS());
+    FunctionNS.emplace_back(std::move(M).getFunctionNS(), Memory.get());
+    ValueNS.emplace_back(std::move(M).getValueNS(), Memory.get());
+    for (const auto &Pair : FunctionNS.back().get())
+      boundFunction(Pair.first, Pair.second, FunctionNS.size() - 1);
+    for (const auto &Pair : ValueNS.back().get())
+      bound(Pair.first, ValueNS.size() - 1);
+  }
+
+  /// Makes the functions and values of \p M visible behind every scope.
+  /// \p M must outlive the interpreter.
+  void addModule(const NativeModule &M) {
+    NativeModules.push_back(&M);
+    mutDispatch().addNatives(NativeModules);
+  }
+
+  /// Whether every function named \p Name is pure. A name without
+  /// functions counts as pure, as calling it fails without side effects.
+  bool isPure(const std::string &Name) const {
+    const auto Candidates = findFunctions(Name);
+    return std::all_of(Candidates.begin(), Candidates.end(),
+                       [](const Function &F) { return F.isPure(); });
+  }
+
+  bool hasFunction(const std::string &Name) const {
+    return !findFunctions(Name).empty();
+  }
+
+  TemporaryStack &getTemporaries() noexcept { return Temporaries; }
+
+  /// How calls by name were dispatched and how deep variable lookups went
+  /// since the last reset. Always empty unless the library was built with
+  /// SKENA_DISPATCH_STATS. Forks count separately; the parallel builtins
+  /// add the counts of their workers to the interpreter calling them.
+  DispatchStats getDispatchStats() const;
+
+  void resetDispatchStats() noexcept { Counts = {}; }
+
+  /// Adds the dispatch counts of \p Fork, which must not be running, to
+  /// those of this interpreter.
+  void mergeDispatchStats(const Interpreter &Fork);
+
+  /// Memory allocated by this interpreter and its forks.
+  MemoryStats getMemoryStats() const noexcept { return Memory->getStats(); }
+
+  /// Makes allocations fail with an EvalError once \p Bytes would be in
+  /// use by this interpreter and its forks; 0 removes the limit.
+  void setMemoryLimit(std::size_t Bytes) noexcept { Memory->setLimit(Bytes); }
+
+  /// Resource for data that outlives the current evaluation.
+  std::pmr::memory_resource *getMemoryResource() const noexcept {
+    return Memory.get();
+  }
+
+  /// Resource for data that does not outlive the current evaluation.
+  std::pmr::memory_resource *getEvalResource() noexcept {
+    return EvalDepth ? &EvalPool : getMemoryResource();
+  }
+
+  /// Changes whenever the set of callable functions changes.
+  std::uint64_t getDispatchGeneration() const noexcept {
+    return Dispatch->getGeneration();
   }
 
 private:
-  const Value *findVariable(const std::string &Name) const noexcept;
+  struct ForkTag {};
+
+  Interpreter(const Interpreter &Other, ForkTag)
+      : Memory(Other.Memory), FunctionNS(Other.FunctionNS),
+        ValueNS(Other.ValueNS),
+        NativeModules(Other.NativeModules), Dispatch(Other.Dispatch),
+        BaseSymbols(Other.BaseSymbols), Pool(Other.Pool) {
+    pushScope();
+  }
+
+  // Scopes pushed by a running evaluation are popped before it returns,
+  // so the names bound in them are never completed and are not indexed.
+  void bound(const std::string &Name, std::size_t Depth) {
+    if (Depth < PersistentScopes)
+      Symbols.add(Name);
+  }
+
+  void boundFunction(const std::string &Name, const Function &F,
+                     std::size_t Depth) {
+    bound(Name, Depth);
+    mutDispatch().add(Name, Depth, F, NativeModules);
+  }
+
+  DispatchTable &mutDispatch() {
+    if (Dispatch.use_count() > 1)
+      Dispatch = std::make_shared<DispatchTable>(*Dispatch);
+    return *Dispatch;
+  }
+
+  void pushScope() {
+    ValueNS.emplace_back();
+    FunctionNS.emplace_back();
+  }
+
+  void popScope() {
+    const bool Indexed = ValueNS.size() - 1 < PersistentScopes;
+    if (Indexed) {
+      for (const auto &Pair : ValueNS.back().get())
+        Symbols.remove(Pair.first);
+    }
+    if (const auto &Functions = FunctionNS.back().get(); !Functions.empty()) {
+      auto &D = mutDispatch();
+      for (const auto &Pair : Functions) {
+        if (Indexed)
+          Symbols.remove(Pair.first);
+        D.remove(Pair.first, FunctionNS.size() - 1);
+      }
+    }
+    ValueNS.pop_back();
+    FunctionNS.pop_back();
+  }
 
-  auto findFunctions(const std::string &Name) const noexcept
-      -> std::vector<std::reference_wrapper<const Function>>;
+  /// Folds Symbols into a new shared BaseSymbols so that forks can share
+  /// the index of every name bound so far.
+  void freezeSymbols() const {
+    if (Symbols.empty())
+      return;
+    auto Merged = BaseSymbols ? std::make_shared<SymbolIndex>(*BaseSymbols)
+                              : std::make_shared<SymbolIndex>();
+    Merged->merge(Symbols);
+    BaseSymbols = std::move(Merged);
+    Symbols = SymbolIndex();
+  }
+
+  /// Converts each of \p Args to the matching parameter type of \p F.
+  /// Returns the number of arguments converted.
+  template <typename Sequence>
+  Expected<std::size_t> convertArguments(const Function &F, Sequence &Args);
 
-  std::vector<std::multimap<std::string, Function>> FunctionNS;
-  std::vector<std::map<std::string, Value>> ValueNS;
+  /// Calls \p F, the function chosen for a call to \p Name.
+  Expected<Value> invoke(const std::string &Name, const Function &F,
+                         ArgumentList &&Args);
 
-  ScopeGuard SG = createScope();
+  /// Applies \p Update to the counters of \p Name, if counting.
+  template <typename Fn> void count(const std::string &Name, Fn Update) {
+    if constexpr (CountDispatch)
+      Update(Counts.Functions[Name]);
+  }
+
+  const Value *findVariable(const std::string &Name, std::size_t Hash) const;
+
+  Value *findScopeVariable(const std::string &Name, std::size_t Hash);
+
+  FunctionRange findFunctions(const std::string &Name) const {
+    return Dispatch->lookup(Name, NativeModules);
+  }
+
+  // Resource of the scope at Depth: scopes that were pushed during the
+  // outermost running evaluation are popped before it returns.
+  std::pmr::memory_resource *scopeResource(std::size_t Depth) noexcept {
+    return Depth >= PersistentScopes ? &EvalPool : getMemoryResource();
+  }
+
+  // Declared first: everything below may hold memory from them.
+  std::shared_ptr<AccountingResource> Memory;
+  std::pmr::monotonic_buffer_resource EvalArena{Memory.get()};
+  std::pmr::unsynchronized_pool_resource EvalPool{&EvalArena};
+  unsigned EvalDepth = 0;
+  std::size_t PersistentScopes = std::numeric_limits<std::size_t>::max();
+
+  std::vector<Frame<NameMultiMap<Function>>> FunctionNS;
+  std::vector<Frame<NameMap<Value>>> ValueNS;
+  std::vector<const NativeModule *> NativeModules;
+
+  // Shared with forks until either side adds or removes a function.
+  std::shared_ptr<DispatchTable> Dispatch = std::make_shared<DispatchTable>();
+
+  // Names bound in ValueNS and FunctionNS: BaseSymbols is shared with
+  // forks, Symbols holds the changes made since the last fork.
+  mutable std::shared_ptr<const SymbolIndex> BaseSymbols;
+  mutable SymbolIndex Symbols;
+
+  // Shared with forks, so that they parse into the same pool.
+  std::shared_ptr<ASTPool> Pool;
+
+  // Not shared with forks.
+  TemporaryStack Temporaries;
+
+  // Present whether or not CountDispatch is set, so that the layout does
+  // not depend on it.
+  struct DispatchCounts {
+    std::unordered_map<std::string, DispatchCounters> Functions;
+    std::vector<std::uint64_t> ScopesSearched;
+    std::uint64_t ScopeMisses = 0;
+  };
+  mutable DispatchCounts Counts;
 };
 
 template <typename Sequence>
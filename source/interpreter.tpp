@@ -4,14 +4,11 @@
 namespace lince {
 
 inline bool isConvertible(Interpreter *C, const std::type_index &From,
-                          const std::type_index &To) noexcept {
-  try {
-    C->getFunction(ConstructorName(To.name()),
-                   std::vector<std::type_index>{To, From});
+                          const std::type_index &To) {
+  if (From == To || To == typeid(Value))
     return true;
-  } catch (EvalError &) {
-    return false;
-  }
+  const std::type_index Type[] = {To, From};
+  return C->findFunction(ConstructorName(To.name()), Type);
 }
 
 template <typename FwdIt1, typename FwdIt2>
@@ -23,86 +20,124 @@ inline bool areConvertible(Interpreter *C, FwdIt1 First, FwdIt1 Last,
     if (!isConvertible(C, *First, *OFirst))
       return false;
     ++First;
+    ++OFirst;
   }
   return true;
 }
 
+inline Expected<Value> Interpreter::invoke(const std::string &Name,
+                                           const Function &F,
+                                           ArgumentList &&Args) {
+  auto Result = F.call(this, std::move(Args));
+  if (!Result)
+    Result.error().CallStack.push_back(Name);
+  return Result;
+}
+
 template <typename Sequence>
-Value Interpreter::callFunction(const std::string &Name, Sequence &&Args) {
-  auto Functions = findFunctions(Name);
+Expected<Value> Interpreter::tryCallFunction(const std::string &Name,
+                                             Sequence &&Args) {
+  const auto Candidates = findFunctions(Name);
+
+  const auto F = std::find_if(
+      Candidates.cbegin(), Candidates.cend(),
+      [&](const Function &Func) { return Func.matchArgs(Args); });
+
+  // Invoke copies: the callee may change the overload set it came from.
+  if (F != Candidates.cend()) {
+    count(Name, [](DispatchCounters &C) { ++C.ExactMatch; });
+    return invoke(Name, Function(*F), std::forward<Sequence>(Args));
+  }
+
   std::vector<std::type_index> ArgTypes;
   std::transform(std::cbegin(Args), std::cend(Args),
                  std::back_inserter(ArgTypes),
                  [](const Value &V) { return std::type_index(V.Data.type()); });
 
-  const auto F = std::find_if(
-      Functions.cbegin(), Functions.cend(),
-      [&](const Function &Func) { return Func.matchType(ArgTypes); });
+  std::vector<std::reference_wrapper<const Function>> Functions(
+      Candidates.cbegin(), Candidates.cend());
+
+  // Functions taking only Values are dynamic functions, called as a last
+  // resort with the arguments unconverted.
+  const auto IsDynamic = [](const Function &F) {
+    return std::all_of(
+        F.getType().cbegin() + 1, F.getType().cend(),
+        [](const std::type_index &TI) { return TI == typeid(Value); });
+  };
 
-  if (F != Functions.cend())
-    return invokeForValue(*F, this, std::forward<Sequence>(Args));
+  const auto Convertible = [&](const Function &F) {
+    return !IsDynamic(F) &&
+           areConvertible(this, ArgTypes.cbegin(), ArgTypes.cend(),
+                          F.getType().cbegin() + 1, F.getType().cend());
+  };
 
   const auto Compare = [&](const Function &X, const Function &Y) {
-    unsigned L = areConvertible(this, ArgTypes.cbegin(), ArgTypes.cend(),
-                                X.Type.cbegin() + 1, X.Type.cend());
-    unsigned R = areConvertible(this, ArgTypes.cbegin(), ArgTypes.cend(),
-                                Y.Type.cbegin() + 1, Y.Type.cend());
-    return L < R;
+    return unsigned(Convertible(X)) < unsigned(Convertible(Y));
   };
 
   std::sort(Functions.begin(), Functions.end(), Compare);
 
-  const auto FirstMatch = std::find_if(
-      Functions.cbegin(), Functions.cend(), [&](const Function &X) {
-        return areConvertible(this, ArgTypes.cbegin(), ArgTypes.cend(),
-                              X.Type.cbegin() + 1, X.Type.cend());
-      });
+  const auto FirstMatch =
+      std::find_if(Functions.begin(), Functions.end(), Convertible);
 
-  const auto NCandidates = std::distance(FirstMatch, Functions.cend());
+  // Of those, only the ones needing the fewest conversions are candidates.
+  const auto NConversions = [&](const Function &F) {
+    return std::inner_product(ArgTypes.cbegin(), ArgTypes.cend(),
+                              F.getType().cbegin() + 1, std::size_t(0),
+                              std::plus<>(), std::not_equal_to<>());
+  };
+  std::stable_sort(FirstMatch, Functions.end(),
+                   [&](const Function &X, const Function &Y) {
+                     return NConversions(X) < NConversions(Y);
+                   });
+  const auto LastMatch =
+      FirstMatch == Functions.end()
+          ? FirstMatch
+          : std::find_if(FirstMatch, Functions.end(), [&](const Function &F) {
+              return NConversions(F) != NConversions(*FirstMatch);
+            });
+
+  const auto NCandidates = std::distance(FirstMatch, LastMatch);
   if (NCandidates == 1) {
-    auto Arg = std::begin(Args);
-    auto Type = FirstMatch->get().Type.cbegin() + 1;
-    while (Arg != Args.end()) {
-      if (*Type != Arg->Data.type()) {
-        std::vector<Value> ConversionArg;
-        ConversionArg.emplace_back(std::move(*Arg));
-        *Arg = callFunction(ConstructorName(Type->name()),
-                            std::move(ConversionArg));
-      }
-      ++Type;
-      ++Arg;
-    }
-    return invokeForValue(*FirstMatch, this, std::forward<Sequence>(Args));
+    const Function Chosen = *FirstMatch;
+    auto Conversions = convertArguments(Chosen, Args);
+    if (!Conversions)
+      return Conversions.takeError();
+    count(Name, [&](DispatchCounters &C) {
+      ++C.Converted;
+      C.Conversions += *Conversions;
+    });
+    return invoke(Name, Chosen, std::forward<Sequence>(Args));
   }
 
   if (NCandidates > 1) {
+    count(Name, [](DispatchCounters &C) { ++C.Ambiguous; });
     std::string Msg = "Ambiguous function call: \n";
-    std::for_each(FirstMatch, Functions.cend(), [&](const Function &Func) {
-      Msg += std::string("Candidate: ") + demangle(Func.Type.front().name()) +
-             ' ' + Name + "(";
-      std::for_each(Func.Type.begin() + 1, Func.Type.end(),
+    std::for_each(FirstMatch, LastMatch, [&](const Function &Func) {
+      Msg += std::string("Candidate: ") +
+             demangle(Func.getType().front().name()) + ' ' + Name + "(";
+      std::for_each(Func.getType().begin() + 1, Func.getType().end(),
                     [&](const std::type_index &TI) {
                       Msg += std::string(" ") + demangle(TI.name()) + ',';
                     });
       Msg.pop_back();
       Msg += " )\n";
     });
-    throw EvalError(Msg);
+    return Error{Error::Eval, std::move(Msg)};
   }
 
   // NCandidates == 0
   // Try dynamic functions
   const auto DynFunc =
-      std::find_if(Functions.cbegin(), Functions.cend(), [](const Function &F) {
-        return std::all_of(
-            F.Type.cbegin() + 1, F.Type.cend(),
-            [](const std::type_index &TI) { return TI == typeid(Value); });
-      });
+      std::find_if(Functions.cbegin(), Functions.cend(), IsDynamic);
 
-  if (DynFunc != Functions.cend())
-    return invokeForValue(*DynFunc, this, std::forward<Sequence>(Args));
+  if (DynFunc != Functions.cend()) {
+    count(Name, [](DispatchCounters &C) { ++C.DynamicFallback; });
+    return invoke(Name, Function(*DynFunc), std::forward<Sequence>(Args));
+  }
 
   // No match
+  count(Name, [](DispatchCounters &C) { ++C.NoMatch; });
   std::string Msg = "No such function: " + Name + ", arguments are: (";
 
   for (auto &&X : Args) {
@@ -112,38 +147,78 @@ Value Interpreter::callFunction(const std::string &Name, Sequence &&Args) {
   Msg.pop_back();
   Msg += " )";
 
-  throw EvalError(Msg);
+  return Error{Error::Eval, std::move(Msg)};
+}
+
+inline Expected<Value> Interpreter::tryCallFunction(const Function &F,
+                                                    ArgumentList Args) {
+  if (Args.size() + 1 != F.getType().size())
+    return Error{Error::Eval, "Wrong number of arguments: expected " +
+                                  std::to_string(F.getType().size() - 1) +
+                                  ", got " + std::to_string(Args.size())};
+  if (auto N = convertArguments(F, Args); !N)
+    return N.takeError();
+  return F.call(this, std::move(Args));
 }
 
 template <typename Sequence>
-inline Function const &Interpreter::getFunction(const std::string &Name,
-                                                Sequence const &Type) const & {
+Expected<std::size_t> Interpreter::convertArguments(const Function &F,
+                                                    Sequence &Args) {
+  std::size_t N = 0;
+  auto Arg = std::begin(Args);
+  auto Type = F.getType().cbegin() + 1;
+  while (Arg != std::end(Args)) {
+    if (*Type != typeid(Value) && *Type != Arg->Data.type()) {
+      ArgumentList ConversionArg(getEvalResource());
+      ConversionArg.emplace_back(std::move(*Arg));
+      auto Converted = tryCallFunction(ConstructorName(Type->name()),
+                                       std::move(ConversionArg));
+      if (!Converted)
+        return Converted.takeError();
+      *Arg = std::move(*Converted);
+      ++N;
+    }
+    ++Type;
+    ++Arg;
+  }
+  return N;
+}
+
+template <typename Sequence>
+inline const Function *Interpreter::findFunction(const std::string &Name,
+                                                 const Sequence &Type) const {
   const auto Functions = findFunctions(Name);
   const auto It = std::find_if(
       Functions.cbegin(), Functions.cend(), [&](Function const &F) {
-        return std::equal(F.Type.cbegin(), F.Type.cend(), std::cbegin(Type),
-                          std::cend(Type));
+        return std::equal(F.getType().cbegin(), F.getType().cend(),
+                          std::cbegin(Type), std::cend(Type));
       });
+  return It == Functions.cend() ? nullptr : &*It;
+}
 
-  if (It == Functions.cend())
-    throw EvalError("No such function");
-  return *It;
+template <typename Sequence>
+inline Function const &Interpreter::getFunction(const std::string &Name,
+                                                Sequence const &Type) const & {
+  if (const auto F = findFunction(Name, Type))
+    return *F;
+  throw EvalError("No such function");
 }
 
 template <typename Sequence>
 Function DynamicFunction(Sequence &&ParamsV, std::shared_ptr<AST> Body) {
   auto Params = std::make_shared<std::vector<std::string>>(
       std::forward<Sequence>(ParamsV));
-  return {[Params, Body](Interpreter *C, std::vector<Value> Args) {
-            const auto _ = C->createScope();
-            const auto N = Params->size();
-            for (size_t I = 0; I != N; ++I) {
-              C->addLocalValue(Params->at(I), Args[I]);
-            }
-            return Body->eval(C);
-          },
-          std::vector(Params->size() + 1,
-                      static_cast<std::type_index>(typeid(Value)))};
+  return Function::checked(
+      [Params, Body](Interpreter *C, ArgumentList Args) {
+        const auto _ = C->createScope();
+        const auto N = Params->size();
+        for (size_t I = 0; I != N; ++I) {
+          C->addLocalValue(Params->at(I), std::move(Args[I]));
+        }
+        return Body->eval(C);
+      },
+      std::vector(Params->size() + 1,
+                  static_cast<std::type_index>(typeid(Value))));
 }
 
 } // namespace lince
\ No newline at end of file
@@ -1,7 +1,10 @@
 #define FMT_STRING_ALIAS 1
 
-#include "astfmt.hpp"
+#include "astprinter.hpp"
 #include "interpreter.hpp"
+#include "moduleloader.hpp"
+#include "optimizer.hpp"
+#include "snapshot.hpp"
 #include "stdlib.hpp"
 
 #include <readline/history.h>
@@ -10,7 +13,11 @@
 #include <fmt/format.h>
 
 #include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
 #include <string_view>
 
 bool readExpr(std::string &Expr) {
@@ -24,6 +31,12 @@ bool readExpr(std::string &Expr) {
 
 lince::Interpreter Calc;
 
+// Where the optimizer describes its rewrites, if anywhere.
+std::ostream *OptimizationLog = nullptr;
+
+// Whether to print how calls were dispatched on exit.
+bool PrintDispatchStats = false;
+
 char *CompletionGenerator(const char *Text, int State) {
   static std::set<std::string> Matches;
   static auto It = Matches.cend();
@@ -40,10 +53,173 @@ char *CompletionGenerator(const char *Text, int State) {
   }
 }
 
-int main() {
+std::string readFile(const char *Path) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In)
+    throw std::runtime_error(std::string("Cannot open ") + Path);
+  return {std::istreambuf_iterator<char>(In), std::istreambuf_iterator<char>()};
+}
+
+// Prints E and, for evaluation errors, the calls and the script line it
+// happened in.
+void printError(const std::exception &E) {
+  print(fmt("{}\n"), E.what());
+  const auto EE = dynamic_cast<const lince::EvalError *>(&E);
+  if (!EE)
+    return;
+  for (const auto &Name : EE->getError().CallStack)
+    print(fmt("  in {}\n"), Name);
+  if (const auto Line = EE->getError().Line)
+    print(fmt("  at line {}\n"), Line);
+}
+
+// Evaluates a script given either as source or as a snapshot.
+int runScript(const char *Path) {
+  try {
+    auto AST = lince::isSnapshotFile(Path) ? lince::loadSnapshot(Path)
+                                           : Calc.parseScript(readFile(Path));
+    if (!AST)
+      return 0;
+    lince::optimize(AST, OptimizationLog);
+    lince::Value V;
+    Calc.eval(AST.get(), V);
+    print(fmt("{}\n"), V.Info());
+  } catch (std::exception &E) {
+    printError(E);
+    return 1;
+  }
+  return 0;
+}
+
+int compileScript(const char *Path, const char *Output) {
+  try {
+    auto AST = Calc.parseScript(readFile(Path));
+    if (!AST)
+      throw std::runtime_error(std::string("Empty script: ") + Path);
+    std::ofstream Out(Output, std::ios::binary);
+    lince::writeSnapshot(*AST, Out);
+    if (!Out)
+      throw std::runtime_error(std::string("Cannot write ") + Output);
+  } catch (std::exception &E) {
+    print(fmt("{}\n"), E.what());
+    return 1;
+  }
+  return 0;
+}
+
+void printDispatchStats() {
+  if (!lince::CountDispatch) {
+    print(stderr, fmt("dispatch statistics need SKENA_DISPATCH_STATS\n"));
+    return;
+  }
+  std::fflush(stdout);
+  const auto S = Calc.getDispatchStats();
+  print(stderr, fmt("{:<20} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n"),
+        "function", "exact", "converted", "conversions", "ambiguous",
+        "dynamic", "no match");
+  const auto Row = [](std::string_view Name, const lince::DispatchCounters &C) {
+    print(stderr, fmt("{:<20} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n"),
+          Name, C.ExactMatch, C.Converted, C.Conversions, C.Ambiguous,
+          C.DynamicFallback, C.NoMatch);
+  };
+  for (const auto &[Name, C] : S.Functions)
+    Row(Name, C);
+  Row("total", S.total());
+  for (std::size_t I = 1; I < S.ScopesSearched.size(); ++I)
+    print(stderr, fmt("variables found after {} scope(s): {}\n"), I,
+          S.ScopesSearched[I]);
+  print(stderr, fmt("variables found in no scope: {}\n"), S.ScopeMisses);
+}
+
+int usage(const char *Program) {
+  print(fmt("usage: {0} [OPTIONS] [--echo=tree|compact|json|none]\n"
+            "       {0} [OPTIONS] SCRIPT\n"
+            "       {0} --compile SCRIPT SNAPSHOT\n"
+            "       {0} --manifest LIBRARY\n"
+            "options: --opt-log         describe optimizations on stderr\n"
+            "         --dispatch-stats  print call statistics on exit\n"
+            "         --hash-cons       share equal subexpressions of parsed "
+            "code\n"
+            "modules are loaded on first use from the manifests (*.skm) in "
+            "the\ndirectories of SKENA_MODULE_PATH\n"),
+        Program);
+  return 2;
+}
+
+// Registers the modules listed by the manifests on SKENA_MODULE_PATH.
+// Their libraries are only loaded once a script uses one of their names.
+void addModules() {
+  static std::vector<std::unique_ptr<lince::NativeModule>> Modules;
+  if (const char *Path = std::getenv("SKENA_MODULE_PATH"))
+    Modules = lince::readManifests(Path);
+  for (const auto &M : Modules)
+    Calc.addModule(*M);
+}
+
+int printManifest(const char *Library) {
+  try {
+    lince::writeManifest(Library, std::cout);
+  } catch (std::exception &E) {
+    print(stderr, fmt("{}\n"), E.what());
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
 
   Calc.addModule(lince::StdLibModule());
 
+  if (argc == 4 && argv[1] == std::string_view("--compile"))
+    return compileScript(argv[2], argv[3]);
+
+  if (argc == 3 && argv[1] == std::string_view("--manifest"))
+    return printManifest(argv[2]);
+
+  try {
+    addModules();
+  } catch (std::exception &E) {
+    print(stderr, fmt("{}\n"), E.what());
+    return 1;
+  }
+
+  while (argc > 1) {
+    const std::string_view Option = argv[1];
+    if (Option == "--opt-log")
+      OptimizationLog = &std::cerr;
+    else if (Option == "--dispatch-stats")
+      PrintDispatchStats = true;
+    else if (Option == "--hash-cons")
+      Calc.setHashConsing(true);
+    else
+      break;
+    argv[1] = argv[0];
+    --argc;
+    ++argv;
+  }
+
+  // How the REPL echoes each parsed expression, if at all.
+  std::optional<lince::PrintStyle> Echo = lince::PrintStyle::Tree;
+
+  if (argc == 2 && std::string_view(argv[1]).substr(0, 7) == "--echo=") {
+    const std::string_view Mode = argv[1] + 7;
+    if (Mode == "none")
+      Echo.reset();
+    else if (Mode == "compact")
+      Echo = lince::PrintStyle::Compact;
+    else if (Mode == "json")
+      Echo = lince::PrintStyle::JSON;
+    else if (Mode != "tree")
+      return usage(argv[0]);
+  } else if (argc == 2) {
+    const int Status = runScript(argv[1]);
+    if (PrintDispatchStats)
+      printDispatchStats();
+    return Status;
+  } else if (argc != 1) {
+    return usage(argv[0]);
+  }
+
   std::string Expr;
 
   ::rl_attempted_completion_function = [](const char *Text, int, int) {
@@ -59,11 +235,20 @@ int main() {
       if (!AST)
         continue;
       lince::Value V;
-      print(fmt("{}\n"), *AST);
+      if (Echo) {
+        fmt::memory_buffer Out;
+        lince::printAST(*AST, Out, *Echo);
+        Out.push_back('\n');
+        std::fwrite(Out.data(), 1, Out.size(), stdout);
+      }
+      lince::optimize(AST, OptimizationLog);
       Calc.eval(AST.get(), V);
       print(fmt("{}\n"), V.Info());
     } catch (std::exception &E) {
-      print(fmt("{}\n"), E.what());
+      printError(E);
     }
   }
+
+  if (PrintDispatchStats)
+    printDispatchStats();
 }
@@ -0,0 +1,82 @@
+#pragma once
+#include "exceptions.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+
+namespace lince {
+
+struct MemoryStats {
+  std::size_t Bytes = 0;         ///< Currently allocated.
+  std::size_t Allocations = 0;   ///< Currently live allocations.
+  std::size_t PeakBytes = 0;     ///< Largest value Bytes has had.
+  std::uint64_t TotalAllocations = 0;
+};
+
+/// Forwards to an upstream resource and keeps count of what is allocated
+/// through it. Allocations that would exceed the limit, if any, throw an
+/// EvalError. Thread-safe if the upstream resource is.
+class AccountingResource : public std::pmr::memory_resource {
+  std::pmr::memory_resource *Upstream;
+  std::atomic<std::size_t> Bytes{0};
+  std::atomic<std::size_t> Allocations{0};
+  std::atomic<std::size_t> PeakBytes{0};
+  std::atomic<std::uint64_t> TotalAllocations{0};
+  std::atomic<std::size_t> Limit{0};
+
+  void *do_allocate(std::size_t N, std::size_t Alignment) override {
+    const auto Now = Bytes.fetch_add(N, std::memory_order_relaxed) + N;
+    const auto Max = Limit.load(std::memory_order_relaxed);
+    if (Max != 0 && Now > Max) {
+      Bytes.fetch_sub(N, std::memory_order_relaxed);
+      throw EvalError("Memory limit of " + std::to_string(Max) +
+                      " bytes exceeded");
+    }
+    void *P;
+    try {
+      P = Upstream->allocate(N, Alignment);
+    } catch (...) {
+      Bytes.fetch_sub(N, std::memory_order_relaxed);
+      throw;
+    }
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    TotalAllocations.fetch_add(1, std::memory_order_relaxed);
+    auto Peak = PeakBytes.load(std::memory_order_relaxed);
+    while (Peak < Now &&
+           !PeakBytes.compare_exchange_weak(Peak, Now,
+                                            std::memory_order_relaxed))
+      ;
+    return P;
+  }
+
+  void do_deallocate(void *P, std::size_t N, std::size_t Alignment) override {
+    Upstream->deallocate(P, N, Alignment);
+    Bytes.fetch_sub(N, std::memory_order_relaxed);
+    Allocations.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool do_is_equal(const memory_resource &Other) const noexcept override {
+    return this == &Other;
+  }
+
+public:
+  explicit AccountingResource(std::pmr::memory_resource *Upstream) noexcept
+      : Upstream(Upstream) {}
+
+  MemoryStats getStats() const noexcept {
+    return {Bytes.load(std::memory_order_relaxed),
+            Allocations.load(std::memory_order_relaxed),
+            PeakBytes.load(std::memory_order_relaxed),
+            TotalAllocations.load(std::memory_order_relaxed)};
+  }
+
+  /// Caps Bytes at \p Max; 0 removes the cap.
+  void setLimit(std::size_t Max) noexcept {
+    Limit.store(Max, std::memory_order_relaxed);
+  }
+};
+
+} // namespace lince
@@ -1,8 +1,18 @@
 #pragma once
+#include "frame.hpp"
+#include "nametable.hpp"
 #include "value.hpp"
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 
 namespace lince {
 
@@ -14,67 +24,338 @@ template <typename Impl> class ModuleBase {
   const Impl *self() const { return static_cast<Impl const *>(this); }
   Impl *self() { return static_cast<Impl *>(this); }
 
+  template <typename Map> static Map &scope(Map &M) noexcept { return M; }
+  template <typename Map> Map &scope(Frame<Map> &F) {
+    return F.mut(self()->getMemoryResource());
+  }
+
+protected:
+  /// Called after a new binding of \p Name was added.
+  void bound(const std::string &) {}
+
+  /// Called after the function \p F was added as \p Name to the scope at
+  /// \p Depth.
+  void boundFunction(const std::string &, const Function &, std::size_t) {}
+
 public:
   decltype(auto) getFunctionNS() && { return std::move(self()->FunctionNS[0]); }
 
   decltype(auto) getValueNS() && { return std::move(self()->ValueNS[0]); }
 
   const Function &addFunction(const std::string &Name, Function TheFunction) {
-    auto It = self()->FunctionNS[0].emplace(Name, std::move(TheFunction));
+    auto It =
+        scope(self()->FunctionNS[0]).emplace(Name, std::move(TheFunction));
+    self()->boundFunction(Name, It->second, 0);
     return It->second;
   }
 
   template <typename T, typename U> const Function &addConstructor() {
-    Function F{[](Interpreter *, std::vector<Value> A) -> Value {
-                 return {T(std::any_cast<U>(A[0].Data))};
+    Function F{[](Interpreter *, ArgumentList A) -> Value {
+                 return makeValue(T(valueCast<U>(A[0])));
                },
-               std::vector<std::type_index>{typeid(T), typeid(U)}};
-    return addFunction(ConstructorName(typeid(T).name()), std::move(F));
+               std::vector<std::type_index>{typeid(StorageType<T>),
+                                            typeid(StorageType<U>)}};
+    return addFunction(ConstructorName(typeid(StorageType<T>).name()),
+                       std::move(F));
   }
 
   const Value &addValue(const std::string &Name, Value TheValue) {
-    return self()->ValueNS[0].emplace(Name, std::move(TheValue)).first->second;
+    auto [It, Inserted] =
+        scope(self()->ValueNS[0]).emplace(Name, std::move(TheValue));
+    if (Inserted)
+      self()->bound(Name);
+    return It->second;
   }
 };
 
 class Module : public ModuleBase<Module> {
-  std::multimap<std::string, Function> FunctionNS[1];
-  std::map<std::string, Value> ValueNS[1];
+  NameMultiMap<Function> FunctionNS[1];
+  NameMap<Value> ValueNS[1];
   friend class ModuleBase<Module>;
 
 public:
 };
 
+/// Calls \p Func with \p Args, which it may move from, as the parameters
+/// of \p Type.
+template <typename Type, typename Callable, std::size_t... I>
+Value invokeUnpacked(Callable &&Func, ArgumentList &Args,
+                     std::index_sequence<I...>) {
+  using Arguments = typename Signature<Type>::Arguments;
+  return invokeForValue(std::forward<Callable>(Func),
+                        argumentCast<std::tuple_element_t<I, Arguments>>(
+                            Args[I])...);
+}
+
+template <typename Type>
+using ArgumentIndices = std::make_index_sequence<
+    std::tuple_size_v<typename Signature<Type>::Arguments>>;
+
+template <typename Type>
+Value functionPointerThunk(void (*Target)(), Interpreter *,
+                           ArgumentList Args) {
+  return invokeUnpacked<Type>(reinterpret_cast<Type *>(Target), Args,
+                              ArgumentIndices<Type>{});
+}
+
+/// Binds \p callable as a function with signature \p Type. Function
+/// pointers and lambdas without captures are called directly; other
+/// callables are stored in a Function::Body.
+template <typename Type, typename Callable = std::decay_t<Type>>
+Function makeFunction(Callable &&callable) {
+  if constexpr (std::is_convertible_v<std::decay_t<Callable>, Type *>) {
+    return {&functionPointerThunk<Type>,
+            reinterpret_cast<void (*)()>(static_cast<Type *>(callable)),
+            Signature<Type>::Types()};
+  } else {
+    return {[Func = std::forward<Callable>(callable)](
+                lince::Interpreter *, lince::ArgumentList Args) {
+              return invokeUnpacked<Type>(Func, Args, ArgumentIndices<Type>{});
+            },
+            Signature<Type>::TypeIndices()};
+  }
+}
+
+/// Binds \p callable with the signature deduced by CallableSignature.
+template <typename Callable,
+          typename = std::enable_if_t<!std::is_function_v<Callable>>>
+Function makeFunction(Callable &&callable) {
+  using Type = typename CallableSignature<std::decay_t<Callable>>::Type;
+  return makeFunction<Type>(std::forward<Callable>(callable));
+}
+
 template <typename Type, typename Callable = std::decay_t<Type>>
 Function UnaryFunction(Callable Func) {
-  return {[Func = std::move(Func)](lince::Interpreter *,
-                                   std::vector<lince::Value> args) {
-            return invokeForValue(
-                Func, std::any_cast<std::tuple_element_t<
-                          0, typename lince::Signature<Type>::Arguments>>(
-                          args[0].Data));
-          },
-          lince::Signature<Type>::TypeIndices()};
+  return makeFunction<Type>(std::move(Func));
 }
 
 template <typename Type, typename Callable = std::decay_t<Type>>
 Function BinaryFunction(Callable Func) {
-  return {
-      [Func = std::move(Func)](lince::Interpreter *,
-                               std::vector<lince::Value> args) {
-        return invokeForValue(
-            Func,
-            std::any_cast<std::tuple_element_t<
-                0, typename lince::Signature<Type>::Arguments>>(args[0].Data),
-            std::any_cast<std::tuple_element_t<
-                1, typename lince::Signature<Type>::Arguments>>(args[1].Data));
-      },
-      lince::Signature<Type>::TypeIndices()};
+  return makeFunction<Type>(std::move(Func));
+}
+
+/// Function or constant of a module declared as a static table.
+struct NativeFunction {
+  std::string_view Name;
+  Function F;
+
+  /// This entry with F marked as pure.
+  NativeFunction pure() const noexcept {
+    auto Copy = *this;
+    Copy.F.setPure();
+    return Copy;
+  }
+};
+
+struct NativeValue {
+  std::string_view Name;
+  Value V;
+};
+
+template <typename Type, Type *Fn>
+Value nativeFunctionThunk(Interpreter *, ArgumentList Args) {
+  return invokeUnpacked<Type>(Fn, Args, ArgumentIndices<Type>{});
+}
+
+template <typename Type, auto Fn>
+Value nativeDeducedThunk(Interpreter *, ArgumentList Args) {
+  return invokeUnpacked<Type>(Fn, Args, ArgumentIndices<Type>{});
 }
 
 template <typename Type, typename Callable>
-Function makeFunction(Callable &&callable) {
-  // TODO
+Value nativeFunctorThunk(Interpreter *, ArgumentList Args) {
+  return invokeUnpacked<Type>(Callable(), Args, ArgumentIndices<Type>{});
+}
+
+/// Table entry binding the plain function \p Fn with signature \p Type.
+template <typename Type, Type *Fn>
+NativeFunction native(std::string_view Name) noexcept {
+  return {Name, {&nativeFunctionThunk<Type, Fn>, Signature<Type>::Types()}};
+}
+
+/// Table entry binding the function or member function \p Fn, whose
+/// signature is deduced.
+template <auto Fn> NativeFunction native(std::string_view Name) noexcept {
+  using Type = typename CallableSignature<decltype(Fn)>::Type;
+  return {Name, {&nativeDeducedThunk<Type, Fn>, Signature<Type>::Types()}};
+}
+
+/// Table entry binding a default-constructed, stateless \p Callable.
+template <typename Type, typename Callable>
+NativeFunction native(std::string_view Name) noexcept {
+  return {Name,
+          {&nativeFunctorThunk<Type, Callable>, Signature<Type>::Types()}};
 }
 
+/// Table entry for a builtin that needs the interpreter. \p Fn receives
+/// the arguments unconverted; \p Type only declares its signature.
+template <typename Type>
+NativeFunction native(std::string_view Name, Function::Thunk Fn) noexcept {
+  return {Name, {Fn, Signature<Type>::Types()}};
+}
+
+template <typename T, typename U> T convert(U X) { return T(std::move(X)); }
+
+/// Table entry for the conversion from \p U to \p T.
+template <typename T, typename U> NativeFunction nativeConstructor() {
+  static const std::string Name =
+      ConstructorName(typeid(StorageType<T>).name());
+  return native<T(U), convert<T, U>>(Name);
+}
+
+/// Read-only module backed by static tables of NativeFunction and
+/// NativeValue. The tables are indexed once; adding the module to an
+/// interpreter only records a pointer to it.
+///
+/// A module can also be lazy: it only knows the names it defines, and
+/// gets its tables from a loader the first time one of its names is
+/// looked up. Loading is thread-safe; if the loader throws, the lookup
+/// fails and the next one tries again.
+class NativeModule {
+  std::vector<const NativeFunction *> Functions;
+  std::vector<const NativeValue *> Values;
+  std::unordered_map<std::string_view, std::vector<Function>> Overloads;
+
+  struct Lazy {
+    std::vector<std::string> FunctionNames; // Sorted.
+    std::vector<std::string> ValueNames;    // Sorted.
+    std::function<const NativeModule *()> Load;
+    std::once_flag Once;
+    std::atomic<const NativeModule *> Target{nullptr};
+  };
+  std::unique_ptr<Lazy> L;
+
+  static constexpr auto ByName = [](const auto *X, const auto *Y) {
+    return X->Name < Y->Name;
+  };
+
+  template <typename Index>
+  static auto range(const Index &I, std::string_view Name) noexcept {
+    return std::equal_range(
+        I.cbegin(), I.cend(), Name, [](const auto &X, const auto &Y) {
+          if constexpr (std::is_same_v<std::decay_t<decltype(X)>,
+                                       std::string_view>)
+            return X < Y->Name;
+          else
+            return X->Name < Y;
+        });
+  }
+
+  static bool contains(const std::vector<std::string> &Names,
+                       std::string_view Name) noexcept {
+    return std::binary_search(Names.cbegin(), Names.cend(), Name,
+                              std::less<>());
+  }
+
+  const NativeModule &target() const {
+    std::call_once(L->Once, [&] { L->Target = L->Load(); });
+    return *L->Target.load(std::memory_order_relaxed);
+  }
+
+public:
+  template <std::size_t NF, std::size_t NV>
+  NativeModule(const NativeFunction (&F)[NF], const NativeValue (&V)[NV]) {
+    for (auto &X : F)
+      Functions.push_back(&X);
+    for (auto &X : V)
+      Values.push_back(&X);
+    std::stable_sort(Functions.begin(), Functions.end(), ByName);
+    std::stable_sort(Values.begin(), Values.end(), ByName);
+    for (auto &X : F)
+      Overloads[X.Name].push_back(X.F);
+  }
+
+  /// Lazy module defining the functions \p FunctionNames and the values
+  /// \p ValueNames. \p Load returns the module with their definitions,
+  /// which must outlive this one.
+  NativeModule(std::vector<std::string> FunctionNames,
+               std::vector<std::string> ValueNames,
+               std::function<const NativeModule *()> Load)
+      : L(std::make_unique<Lazy>()) {
+    std::sort(FunctionNames.begin(), FunctionNames.end());
+    std::sort(ValueNames.begin(), ValueNames.end());
+    L->FunctionNames = std::move(FunctionNames);
+    L->ValueNames = std::move(ValueNames);
+    L->Load = std::move(Load);
+  }
+
+  NativeModule(const NativeModule &) = delete;
+  NativeModule &operator=(const NativeModule &) = delete;
+
+  /// Whether a lazy module has been loaded. Other modules always are.
+  bool isLoaded() const noexcept {
+    return !L || L->Target.load(std::memory_order_acquire) != nullptr;
+  }
+
+  /// Whether the module defines a function named \p Name. Never loads it.
+  bool hasFunction(std::string_view Name) const noexcept {
+    return L ? contains(L->FunctionNames, Name) : Overloads.count(Name) != 0;
+  }
+
+  /// Every overload named \p Name, in table order.
+  FunctionRange getOverloads(std::string_view Name) const {
+    if (L)
+      return contains(L->FunctionNames, Name) ? target().getOverloads(Name)
+                                              : FunctionRange();
+    const auto It = Overloads.find(Name);
+    return It != Overloads.cend() ? FunctionRange(It->second)
+                                  : FunctionRange();
+  }
+
+  /// Calls \p Fn with the name of every overload set.
+  template <typename Callback> void forEachFunctionName(Callback &&Fn) const {
+    if (L) {
+      for (const auto &Name : L->FunctionNames)
+        Fn(std::string_view(Name));
+      return;
+    }
+    for (const auto &Pair : Overloads)
+      Fn(Pair.first);
+  }
+
+  /// Calls \p Fn with the name of every value.
+  template <typename Callback> void forEachValueName(Callback &&Fn) const {
+    if (L) {
+      for (const auto &Name : L->ValueNames)
+        Fn(std::string_view(Name));
+      return;
+    }
+    for (const auto *X : Values)
+      Fn(X->Name);
+  }
+
+  const Value *findValue(std::string_view Name) const {
+    if (L)
+      return contains(L->ValueNames, Name) ? target().findValue(Name)
+                                           : nullptr;
+    auto [Begin, End] = range(Values, Name);
+    return Begin != End ? &(*Begin)->V : nullptr;
+  }
+
+  /// Calls \p Fn with every function and value name starting with
+  /// \p Prefix, once per table entry, or once per name if lazy.
+  template <typename Callback>
+  void forEachNameWithPrefix(std::string_view Prefix, Callback &&Fn) const {
+    const auto Visit = [&](const auto &I, auto Name) {
+      auto It = std::lower_bound(
+          I.cbegin(), I.cend(), Prefix,
+          [&](const auto &X, std::string_view Y) { return Name(X) < Y; });
+      for (; It != I.cend() && Name(*It).substr(0, Prefix.size()) == Prefix;
+           ++It)
+        Fn(Name(*It));
+    };
+    if (L) {
+      const auto Identity = [](const std::string &X) {
+        return std::string_view(X);
+      };
+      Visit(L->FunctionNames, Identity);
+      Visit(L->ValueNames, Identity);
+      return;
+    }
+    const auto EntryName = [](const auto *X) { return X->Name; };
+    Visit(Functions, EntryName);
+    Visit(Values, EntryName);
+  }
+};
+
 } // namespace lince
@@ -0,0 +1,129 @@
+#include "moduleloader.hpp"
+#include "exceptions.hpp"
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+namespace lince {
+
+namespace {
+
+// Opens the library at Path and returns its module. The library is never
+// closed, as the functions of the module may be referenced anywhere.
+const NativeModule *loadLibrary(const std::string &Path) {
+  void *Handle = ::dlopen(Path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!Handle)
+    throw EvalError("Cannot load module: " + std::string(::dlerror()));
+  using EntryPoint = const NativeModule *(*)();
+  const auto Entry =
+      reinterpret_cast<EntryPoint>(::dlsym(Handle, ModuleEntryPoint));
+  if (!Entry)
+    throw EvalError("Not a module: " + Path);
+  if (const auto M = Entry())
+    return M;
+  throw EvalError("Module failed to initialize: " + Path);
+}
+
+// Removes the first word of Line, separated by blanks, and returns it.
+std::string_view nextWord(std::string_view &Line) {
+  constexpr std::string_view Blanks = " \t\r";
+  const auto Begin = std::min(Line.find_first_not_of(Blanks), Line.size());
+  const auto End = std::min(Line.find_first_of(Blanks, Begin), Line.size());
+  const auto Word = Line.substr(Begin, End - Begin);
+  Line.remove_prefix(End);
+  return Word;
+}
+
+} // namespace
+
+std::unique_ptr<NativeModule> readManifest(const std::string &Path) {
+  std::ifstream In(Path, std::ios::binary);
+  if (!In)
+    throw ParseError("Cannot open " + Path);
+  std::ostringstream Buffer;
+  Buffer << In.rdbuf();
+  const std::string Text = std::move(Buffer).str();
+
+  std::string Library;
+  std::vector<std::string> Functions, Values;
+  std::string_view Rest = Text;
+  for (unsigned LineNo = 1; !Rest.empty(); ++LineNo) {
+    auto Line = Rest.substr(0, Rest.find('\n'));
+    Rest.remove_prefix(std::min(Line.size() + 1, Rest.size()));
+    const auto Directive = nextWord(Line);
+    if (Directive.empty() || Directive[0] == '#')
+      continue;
+    const auto Arg = nextWord(Line);
+    if (Arg.empty() || !nextWord(Line).empty())
+      throw ParseError(Path + ":" + std::to_string(LineNo) +
+                       ": expected one argument");
+    if (Directive == "library")
+      Library = Arg;
+    else if (Directive == "function")
+      Functions.emplace_back(Arg);
+    else if (Directive == "value")
+      Values.emplace_back(Arg);
+    else
+      throw ParseError(Path + ":" + std::to_string(LineNo) +
+                       ": unknown directive " + std::string(Directive));
+  }
+  if (Library.empty())
+    throw ParseError(Path + ": no library");
+
+  const auto LibraryPath =
+      (std::filesystem::path(Path).parent_path() / Library).string();
+  return std::make_unique<NativeModule>(
+      std::move(Functions), std::move(Values),
+      [LibraryPath] { return loadLibrary(LibraryPath); });
+}
+
+std::vector<std::unique_ptr<NativeModule>>
+readManifests(const std::string &SearchPath) {
+  namespace fs = std::filesystem;
+  std::vector<std::unique_ptr<NativeModule>> Modules;
+  std::size_t Begin = 0;
+  while (Begin <= SearchPath.size()) {
+    auto End = SearchPath.find(':', Begin);
+    if (End == std::string::npos)
+      End = SearchPath.size();
+    const auto Dir = SearchPath.substr(Begin, End - Begin);
+    Begin = End + 1;
+
+    std::error_code EC;
+    if (Dir.empty() || !fs::is_directory(Dir, EC))
+      continue;
+    std::vector<fs::path> Manifests;
+    for (const auto &E : fs::directory_iterator(Dir, EC)) {
+      if (E.path().extension() == ".skm")
+        Manifests.push_back(E.path());
+    }
+    std::sort(Manifests.begin(), Manifests.end());
+    for (const auto &P : Manifests)
+      Modules.push_back(readManifest(P.string()));
+  }
+  return Modules;
+}
+
+void writeManifest(const std::string &Library, std::ostream &OS) {
+  const auto M = loadLibrary(Library);
+  std::vector<std::string_view> Functions, Values;
+  M->forEachFunctionName([&](std::string_view N) { Functions.push_back(N); });
+  M->forEachValueName([&](std::string_view N) { Values.push_back(N); });
+  std::sort(Functions.begin(), Functions.end());
+  Values.erase(std::unique(Values.begin(), Values.end()), Values.end());
+
+  OS << "library " << std::filesystem::path(Library).filename().string()
+     << '\n';
+  for (const auto N : Functions)
+    OS << "function " << N << '\n';
+  for (const auto N : Values)
+    OS << "value " << N << '\n';
+}
+
+} // namespace lince
@@ -0,0 +1,39 @@
+#pragma once
+#include "module.hpp"
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace lince {
+
+/// Symbol a shared library exports to be loaded as a module, declared as
+///   extern "C" const lince::NativeModule *skena_module();
+/// The module it returns must live until the program exits.
+constexpr const char *ModuleEntryPoint = "skena_module";
+
+/// Reads the module manifest at \p Path and returns a lazy module that
+/// loads the library it names the first time one of its names is used.
+///
+/// A manifest lists one directive per line; blank lines and lines
+/// starting with '#' are skipped:
+///   library PATH   the shared library, relative to the manifest
+///   function NAME  a function the library defines
+///   value NAME     a value the library defines
+///
+/// Throws a ParseError if the manifest cannot be read. Loading throws an
+/// EvalError if the library or its entry point is missing.
+std::unique_ptr<NativeModule> readManifest(const std::string &Path);
+
+/// Reads every manifest ending in ".skm" in the directories of the
+/// colon-separated \p SearchPath, in order, and each directory's in name
+/// order. Directories that do not exist are skipped.
+std::vector<std::unique_ptr<NativeModule>>
+readManifests(const std::string &SearchPath);
+
+/// Loads the library at \p Library and writes a manifest of its names to
+/// \p OS. Throws an EvalError if it cannot be loaded.
+void writeManifest(const std::string &Library, std::ostream &OS);
+
+} // namespace lince
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace lince {
+
+/// Hash of a name as used by NameTable, so that callers can compute it
+/// once for many lookups.
+inline std::size_t hashName(std::string_view Name) noexcept {
+  return std::hash<std::string_view>()(Name);
+}
+
+/// Bindings of names to \p Mapped, iterated in insertion order. If
+/// \p Multi is set, a name may be bound several times.
+///
+/// The bindings are stored in a deque, so references to them stay valid
+/// as others are added, and indexed by an open-addressing table of 8-byte
+/// slots holding 32 bits of the hash of the name, which decide both the
+/// probe sequence and whether a name has to be compared at all.
+///
+/// Bindings cannot be removed: scopes are discarded as a whole.
+template <typename Mapped, bool Multi = false> class NameTable {
+public:
+  using value_type = std::pair<const std::string, Mapped>;
+  using allocator_type = std::pmr::polymorphic_allocator<value_type>;
+  using iterator = typename std::pmr::deque<value_type>::iterator;
+  using const_iterator = typename std::pmr::deque<value_type>::const_iterator;
+
+private:
+  struct Slot {
+    std::uint32_t Tag;
+    std::uint32_t Pos; ///< 1 + index into Entries, or 0 if empty.
+  };
+
+  std::pmr::deque<value_type> Entries;
+  std::pmr::vector<Slot> Slots;
+
+  static std::uint32_t tagOf(std::size_t Hash) noexcept {
+    if constexpr (sizeof(std::size_t) > 4)
+      Hash ^= Hash >> 32;
+    return static_cast<std::uint32_t>(Hash);
+  }
+
+  std::size_t mask() const noexcept { return Slots.size() - 1; }
+
+  void place(std::uint32_t Tag, std::uint32_t Pos) noexcept {
+    auto I = Tag & mask();
+    while (Slots[I].Pos != 0)
+      I = (I + 1) & mask();
+    Slots[I] = {Tag, Pos};
+  }
+
+  // Makes room for one more binding at a load factor of at most 3/4.
+  void reserveOne() {
+    if ((Entries.size() + 1) * 4 <= Slots.size() * 3)
+      return;
+    std::pmr::vector<Slot> Old(Slots.size() ? Slots.size() * 2 : 8,
+                               Slot{0, 0}, Slots.get_allocator());
+    Old.swap(Slots);
+    for (const auto &S : Old) {
+      if (S.Pos != 0)
+        place(S.Tag, S.Pos);
+    }
+  }
+
+  template <typename... Args>
+  iterator append(std::uint32_t Tag, std::string_view Name, Args &&... A) {
+    reserveOne();
+    Entries.emplace_back(std::piecewise_construct,
+                         std::forward_as_tuple(Name),
+                         std::forward_as_tuple(std::forward<Args>(A)...));
+    place(Tag, static_cast<std::uint32_t>(Entries.size()));
+    return std::prev(Entries.end());
+  }
+
+  std::size_t findIndex(std::string_view Name, std::size_t Hash) const
+      noexcept {
+    if (Slots.empty())
+      return Entries.size();
+    const auto Tag = tagOf(Hash);
+    for (auto I = Tag & mask(); Slots[I].Pos != 0; I = (I + 1) & mask()) {
+      if (Slots[I].Tag == Tag && Entries[Slots[I].Pos - 1].first == Name)
+        return Slots[I].Pos - 1;
+    }
+    return Entries.size();
+  }
+
+public:
+  NameTable() = default;
+
+  explicit NameTable(const allocator_type &A) : Entries(A), Slots(A) {}
+
+  NameTable(const NameTable &Other, const allocator_type &A)
+      : Entries(Other.Entries, A), Slots(Other.Slots, A) {}
+
+  NameTable(NameTable &&Other, const allocator_type &A)
+      : Entries(std::move(Other.Entries), A),
+        Slots(std::move(Other.Slots), A) {}
+
+  NameTable(const NameTable &) = default;
+  NameTable(NameTable &&) noexcept = default;
+  NameTable &operator=(const NameTable &) = default;
+  NameTable &operator=(NameTable &&) noexcept = default;
+
+  allocator_type get_allocator() const noexcept {
+    return Entries.get_allocator();
+  }
+
+  std::size_t size() const noexcept { return Entries.size(); }
+  bool empty() const noexcept { return Entries.empty(); }
+
+  iterator begin() noexcept { return Entries.begin(); }
+  iterator end() noexcept { return Entries.end(); }
+  const_iterator begin() const noexcept { return Entries.cbegin(); }
+  const_iterator end() const noexcept { return Entries.cend(); }
+  const_iterator cbegin() const noexcept { return Entries.cbegin(); }
+  const_iterator cend() const noexcept { return Entries.cend(); }
+
+  /// The first binding of \p Name, whose hashName is \p Hash.
+  iterator find(std::string_view Name, std::size_t Hash) noexcept {
+    return Entries.begin() + findIndex(Name, Hash);
+  }
+
+  const_iterator find(std::string_view Name, std::size_t Hash) const
+      noexcept {
+    return Entries.cbegin() + findIndex(Name, Hash);
+  }
+
+  iterator find(std::string_view Name) noexcept {
+    return find(Name, hashName(Name));
+  }
+
+  const_iterator find(std::string_view Name) const noexcept {
+    return find(Name, hashName(Name));
+  }
+
+  /// 1 if \p Name is bound, otherwise 0.
+  std::size_t count(std::string_view Name) const noexcept {
+    return find(Name) != end();
+  }
+
+  /// Binds \p Name to a \p Mapped made from \p A unless it is bound.
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(std::string_view Name, Args &&... A) {
+    static_assert(!Multi, "use emplace to bind a name again");
+    const auto Hash = hashName(Name);
+    if (const auto It = find(Name, Hash); It != end())
+      return {It, false};
+    return {append(tagOf(Hash), Name, std::forward<Args>(A)...), true};
+  }
+
+  /// Binds \p Name to a \p Mapped made from \p A. Unless Multi is set,
+  /// this does nothing if \p Name is bound already.
+  template <typename... Args>
+  auto emplace(std::string_view Name, Args &&... A) {
+    if constexpr (Multi)
+      return append(tagOf(hashName(Name)), Name, std::forward<Args>(A)...);
+    else
+      return try_emplace(Name, std::forward<Args>(A)...);
+  }
+};
+
+template <typename Mapped> using NameMap = NameTable<Mapped>;
+template <typename Mapped> using NameMultiMap = NameTable<Mapped, true>;
+
+} // namespace lince
@@ -0,0 +1,280 @@
+#include "optimizer.hpp"
+#include "astimpl.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace lince {
+
+namespace {
+
+std::string operatorName(int Op) {
+  return std::string("operator") + static_cast<char>(Op);
+}
+
+// What evaluating a subtree may change or depend on.
+struct Effects {
+  std::set<std::string> Assigned;
+  std::set<std::string> Called;
+  bool DefinesFunctions = false;
+  bool CallsValues = false;
+};
+
+// Whether A may be replaced by a temporary: it only reads constants and
+// variables not in Assigned, and calls functions by name. Adds the names
+// of those functions to Calls.
+bool isCandidate(const AST &A, const std::set<std::string> &Assigned,
+                 std::set<std::string> &Calls, bool &ReadsVariables) {
+  if (dynamic_cast<const ConstExprAST *>(&A) ||
+      dynamic_cast<const TemporaryAST *>(&A))
+    return true;
+  if (const auto I = dynamic_cast<const IdentifierAST *>(&A)) {
+    ReadsVariables = true;
+    return Assigned.count(I->getName()) == 0;
+  }
+  if (const auto S = dynamic_cast<const SharedAST *>(&A))
+    return isCandidate(S->get(), Assigned, Calls, ReadsVariables);
+  if (const auto U = dynamic_cast<const UnaryExprAST *>(&A)) {
+    Calls.insert(operatorName(U->getOp()));
+    return isCandidate(U->getOperand(), Assigned, Calls, ReadsVariables);
+  }
+  if (const auto B = dynamic_cast<const BinExprAST *>(&A)) {
+    if (B->getOp() == '=')
+      return false;
+    Calls.insert(operatorName(B->getOp()));
+    return isCandidate(B->getLHS(), Assigned, Calls, ReadsVariables) &&
+           isCandidate(B->getRHS(), Assigned, Calls, ReadsVariables);
+  }
+  if (const auto C = dynamic_cast<const CallExprAST *>(&A)) {
+    Calls.insert(C->getFunctionName());
+    return std::all_of(C->getArgs().cbegin(), C->getArgs().cend(),
+                       [&](const auto &X) {
+                         return isCandidate(*X, Assigned, Calls,
+                                            ReadsVariables);
+                       });
+  }
+  return false;
+}
+
+// Nodes whose temporaries were already placed by an inner loop.
+bool isOptimizedLoop(const AST &A) {
+  return dynamic_cast<const WhileExprAST *>(&A) ||
+         dynamic_cast<const TemporaryScopeAST *>(&A);
+}
+
+} // namespace
+
+class Optimizer {
+  std::ostream *Log;
+
+  // Temporaries of one scope under construction.
+  struct TemporarySet {
+    std::unique_ptr<TemporaryScopeAST> Scope =
+        std::make_unique<TemporaryScopeAST>();
+    // Slot and number of uses of each distinct expression.
+    std::map<std::string, std::pair<std::size_t, unsigned>> Slots;
+    std::set<std::string> Calls;
+    bool ReadsVariables = false;
+  };
+
+  // Subtrees shared by a SharedAST are left alone, as rewriting them would
+  // change every occurrence.
+  template <typename Fn> static void forEachChild(AST &A, Fn &&F) {
+    if (const auto U = dynamic_cast<UnaryExprAST *>(&A)) {
+      F(U->Operand);
+    } else if (const auto B = dynamic_cast<BinExprAST *>(&A)) {
+      F(B->LHS);
+      F(B->RHS);
+    } else if (const auto S = dynamic_cast<SequenceAST *>(&A)) {
+      for (auto &X : S->Statements)
+        F(X);
+    } else if (const auto C = dynamic_cast<CallExprAST *>(&A)) {
+      for (auto &X : C->Args)
+        F(X);
+    } else if (const auto L = dynamic_cast<LambdaCallExpr *>(&A)) {
+      F(L->Lambda);
+      for (auto &X : L->Args)
+        F(X);
+    } else if (const auto I = dynamic_cast<IfExprAST *>(&A)) {
+      F(I->Condition);
+      F(I->Then);
+      if (I->Else)
+        F(I->Else);
+    } else if (const auto W = dynamic_cast<WhileExprAST *>(&A)) {
+      F(W->Condition);
+      F(W->Body);
+    } else if (const auto T = dynamic_cast<TranslationUnitAST *>(&A)) {
+      for (auto &X : T->ExprList)
+        F(X);
+    } else if (const auto S = dynamic_cast<TemporaryScopeAST *>(&A)) {
+      F(S->Body);
+    } else if (const auto T = dynamic_cast<TemporaryAST *>(&A)) {
+      F(T->Expr);
+    }
+  }
+
+  static void collect(AST &A, Effects &E) {
+    if (const auto S = dynamic_cast<SharedAST *>(&A))
+      return collect(*S->getNode()->Expr, E);
+    if (const auto B = dynamic_cast<BinExprAST *>(&A); B && B->Op == '=') {
+      if (const auto I = dynamic_cast<IdentifierAST *>(B->LHS.get()))
+        E.Assigned.insert(I->getName());
+      else
+        E.DefinesFunctions = true;
+      collect(*B->RHS, E);
+      return;
+    }
+    if (const auto U = dynamic_cast<UnaryExprAST *>(&A))
+      E.Called.insert(operatorName(U->Op));
+    else if (const auto B = dynamic_cast<BinExprAST *>(&A))
+      E.Called.insert(operatorName(B->Op));
+    else if (const auto C = dynamic_cast<CallExprAST *>(&A))
+      E.Called.insert(C->Name);
+    else if (const auto S = dynamic_cast<SequenceAST *>(&A))
+      E.Called.insert(S->getFunctionName());
+    else if (dynamic_cast<LambdaCallExpr *>(&A))
+      E.CallsValues = true;
+    forEachChild(A, [&](auto &X) { collect(*X, E); });
+  }
+
+  template <typename Ptr>
+  static void replace(Ptr &Node, TemporarySet &T,
+                      const std::set<std::string> &Calls, bool Reads) {
+    auto [It, Inserted] = T.Slots.try_emplace(
+        Node->dump(), std::make_pair(T.Slots.size(), 0u));
+    ++It->second.second;
+    T.Calls.insert(Calls.cbegin(), Calls.cend());
+    T.ReadsVariables |= Reads;
+    Node = std::make_unique<TemporaryAST>(std::shared_ptr<AST>(std::move(Node)),
+                                          T.Scope.get(), It->second.first);
+  }
+
+  // Replaces the largest loop-invariant expressions below Node.
+  template <typename Ptr>
+  void hoist(Ptr &Node, const std::set<std::string> &Assigned,
+             TemporarySet &T) {
+    if (isOptimizedLoop(*Node))
+      return;
+    std::set<std::string> Calls;
+    bool Reads = false;
+    if (isCandidate(*Node, Assigned, Calls, Reads) && !Calls.empty())
+      return replace(Node, T, Calls, Reads);
+    forEachChild(*Node, [&](auto &X) { hoist(X, Assigned, T); });
+  }
+
+  static void countCandidates(AST &A,
+                              const std::set<std::string> &Assigned,
+                              std::map<std::string, unsigned> &Count) {
+    if (isOptimizedLoop(A) || dynamic_cast<const TemporaryAST *>(&A))
+      return;
+    std::set<std::string> Calls;
+    bool Reads = false;
+    if (isCandidate(A, Assigned, Calls, Reads) && !Calls.empty())
+      ++Count[A.dump()];
+    forEachChild(A, [&](auto &X) { countCandidates(*X, Assigned, Count); });
+  }
+
+  // Replaces the largest expressions below Node that occur more than once.
+  template <typename Ptr>
+  void share(Ptr &Node, const std::set<std::string> &Assigned,
+             const std::map<std::string, unsigned> &Count, TemporarySet &T) {
+    if (isOptimizedLoop(*Node) || dynamic_cast<TemporaryAST *>(Node.get()))
+      return;
+    std::set<std::string> Calls;
+    bool Reads = false;
+    if (isCandidate(*Node, Assigned, Calls, Reads) && !Calls.empty()) {
+      if (const auto It = Count.find(Node->dump());
+          It != Count.end() && It->second > 1)
+        return replace(Node, T, Calls, Reads);
+    }
+    forEachChild(*Node, [&](auto &X) { share(X, Assigned, Count, T); });
+  }
+
+  // Wraps Node into the scope of T, if T has any temporary.
+  template <typename Ptr>
+  void wrap(Ptr &Node, TemporarySet &T, const Effects &E,
+            const char *What) {
+    if (T.Slots.empty())
+      return;
+    auto &S = *T.Scope;
+    S.NSlots = T.Slots.size();
+    // Functions that are not pure could assign the variables read.
+    if (T.ReadsVariables)
+      T.Calls.insert(E.Called.cbegin(), E.Called.cend());
+    S.RequiredPure.assign(T.Calls.cbegin(), T.Calls.cend());
+    // Purity is only known at run time, so the rewrites are logged as
+    // guarded by it.
+    if (Log) {
+      for (const auto &[Expr, Slot] : T.Slots)
+        *Log << What << " (used " << Slot.second
+             << " times, guarded): " << Expr << '\n';
+      *Log << "  only if these are pure when run:";
+      for (const auto &F : S.RequiredPure)
+        *Log << ' ' << F;
+      *Log << '\n';
+    }
+    S.Body = std::move(Node);
+    Node = std::move(T.Scope);
+  }
+
+  template <typename Ptr> void eliminate(Ptr &Statement) {
+    Effects E;
+    collect(*Statement, E);
+    std::map<std::string, unsigned> Count;
+    countCandidates(*Statement, E.Assigned, Count);
+    if (std::none_of(Count.cbegin(), Count.cend(),
+                     [](const auto &P) { return P.second > 1; }))
+      return;
+    TemporarySet T;
+    share(Statement, E.Assigned, Count, T);
+    wrap(Statement, T, E, "shared common subexpression");
+  }
+
+  template <typename Ptr, typename Fn>
+  static void forEachStatement(Ptr &Node, Fn &&F) {
+    if (const auto S = dynamic_cast<SequenceAST *>(Node.get())) {
+      for (auto &X : S->Statements)
+        forEachStatement(X, F);
+    } else {
+      F(Node);
+    }
+  }
+
+  template <typename Ptr> void optimizeLoop(Ptr &Loop) {
+    auto &W = static_cast<WhileExprAST &>(*Loop);
+    Effects E;
+    collect(W, E);
+    if (E.DefinesFunctions || E.CallsValues) {
+      if (Log)
+        *Log << "loop not optimized: it "
+             << (E.DefinesFunctions ? "defines functions"
+                                    : "calls function values")
+             << '\n';
+      return;
+    }
+
+    TemporarySet T;
+    hoist(W.Condition, E.Assigned, T);
+    hoist(W.Body, E.Assigned, T);
+    eliminate(W.Condition);
+    forEachStatement(W.Body, [&](auto &S) { eliminate(S); });
+    wrap(Loop, T, E, "hoisted loop-invariant expression");
+  }
+
+public:
+  explicit Optimizer(std::ostream *Log) noexcept : Log(Log) {}
+
+  template <typename Ptr> void run(Ptr &Node) {
+    forEachChild(*Node, [&](auto &X) { run(X); });
+    if (dynamic_cast<WhileExprAST *>(Node.get()))
+      optimizeLoop(Node);
+  }
+};
+
+void optimize(std::unique_ptr<AST> &Program, std::ostream *Log) {
+  if (Program)
+    Optimizer(Log).run(Program);
+}
+
+} // namespace lince
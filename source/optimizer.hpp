@@ -0,0 +1,21 @@
+#pragma once
+#include "ast.hpp"
+
+#include <memory>
+#include <ostream>
+
+namespace lince {
+
+/// Rewrites the while loops in \p Program so that pure expressions are not
+/// evaluated again when their value cannot have changed:
+///  - an expression whose variables are not assigned in the loop is
+///    evaluated once per execution of the loop, when it is first needed;
+///  - identical expressions within one statement of the loop body are
+///    evaluated once per execution of the statement.
+///
+/// An expression is pure if every function it calls is. As functions can
+/// be redefined, this is checked whenever a loop starts, and the loop runs
+/// unchanged if the check fails. Every rewrite is described on \p Log.
+void optimize(std::unique_ptr<AST> &Program, std::ostream *Log = nullptr);
+
+} // namespace lince
@@ -1,18 +1,20 @@
 #include "parser.hpp"
 #include "astimpl.hpp"
+#include "astpool.hpp"
 
 #include <cassert>
-#include <map>
-#include <set>
+#include <charconv>
+#include <limits>
+#include <utility>
 
 namespace lince {
 
 std::string Token::descriptionof() const {
   switch (Kind) {
   case TK_Identifier:
-    return Str;
+    return std::string(Str);
   case TK_Number:
-    return Str;
+    return std::string(Str);
   case TK_If:
     return "<if>";
   case TK_Else:
@@ -30,66 +32,77 @@ std::string Token::descriptionof() const {
   }
 }
 
+Value Token::numberof() const {
+  const auto First = Str.data(), Last = Str.data() + Str.size();
+  std::from_chars_result R;
+  Value V;
+  if (Str.find_first_of(".eE") != std::string_view::npos) {
+    double X;
+    R = std::from_chars(First, Last, X);
+    V = {X};
+  } else {
+    long long X;
+    R = std::from_chars(First, Last, X);
+    if (R.ec == std::errc::result_out_of_range)
+      throw ParseError("Integer literal out of range: " + std::string(Str));
+    if (X >= std::numeric_limits<int>::min() &&
+        X <= std::numeric_limits<int>::max())
+      V = {static_cast<int>(X)};
+    else
+      V = {X};
+  }
+  if (R.ec != std::errc() || R.ptr != Last)
+    throw ParseError("Invalid number literal: " + std::string(Str));
+  return V;
+}
+
 Token Parser::parseToken() {
-  int C;
-  while (std::isspace((C = SS.get())))
-    ;
+  using namespace lexer;
 
-  if (C == '"' || C == '\'') {
-    const char Quote = C;
-    std::string S;
-    while (true) {
-      C = SS.get();
-      if (C == Quote && (S.empty() || S.back() != '\\'))
-        return {TK_String, std::move(S)};
-      S.push_back(C);
-    }
-  }
+  const auto N = Source.size();
+  while (Pos != N && is(Source[Pos], CC_Space))
+    ++Pos;
+
+  if (Pos == N)
+    return {TK_END};
 
-  if (std::isalpha(C) || C == '_') {
-    std::string S;
-    S.push_back(C);
+  const auto Start = Pos;
+  const char C = Source[Pos++];
+
+  if (is(C, CC_Quote)) {
     while (true) {
-      C = SS.get();
-      if (!std::isalnum(C) && C != '_')
+      if (Pos == N)
+        throw ParseError("Unterminated string literal");
+      if (Source[Pos] == C && (Pos == Start + 1 || Source[Pos - 1] != '\\'))
         break;
-      S.push_back(C);
+      ++Pos;
     }
-    SS.unget();
-
-    if (auto It = Keywords.find(S); It != Keywords.cend())
-      return {It->second, It->first};
-
-    return {TK_Identifier, std::move(S)};
+    return {TK_String, Source.substr(Start + 1, Pos++ - Start - 1)};
   }
 
-  if (std::isdigit(C) || C == '.') {
-    std::string S;
-    do {
-      if (C == '-' || C == '+') {
-        if (S.empty() || (S.back() != 'e' && S.back() != 'E')) {
-          break;
-        }
-      }
-
-      if (C == '.' && S.find('.') < S.length())
-        break;
-      S.push_back(C);
-      C = SS.get();
-    } while (std::isdigit(C) || C == '.' || C == 'e' || C == 'E' || C == '-' ||
-             C == '+');
-    SS.unget();
-    return {TK_Number, std::move(S)};
+  if (is(C, CC_IdentStart)) {
+    while (Pos != N && is(Source[Pos], CC_Ident))
+      ++Pos;
+    const auto S = Source.substr(Start, Pos - Start);
+    return {keywordKind(S), S};
   }
 
-  if (C == EOF || C == '\n') {
-    SS.unget();
-    return {TK_END};
+  if (is(C, CC_Digit) || C == '.') {
+    bool SeenDot = C == '.';
+    for (; Pos != N && is(Source[Pos], CC_Number); ++Pos) {
+      const char X = Source[Pos];
+      if ((X == '-' || X == '+') &&
+          (Source[Pos - 1] != 'e' && Source[Pos - 1] != 'E'))
+        break;
+      if (X == '.' && std::exchange(SeenDot, true))
+        break;
+    }
+    return {TK_Number, Source.substr(Start, Pos - Start)};
   }
 
-  if (C > 127 || C < 0) {
+  if (static_cast<unsigned char>(C) > 127) {
     throw ParseError("Non-ascii character: " +
-                     std::to_string(static_cast<unsigned>(C)));
+                     std::to_string(static_cast<unsigned char>(C)));
   }
 
   return {C};
@@ -99,6 +112,10 @@ std::unique_ptr<AST> Parser::parseExpr() {
   return parseBinOpRHS(parseUnary(), 0);
 }
 
+std::unique_ptr<AST> Parser::share(std::unique_ptr<AST> A) {
+  return Pool ? Pool->intern(std::move(A)) : std::move(A);
+}
+
 std::unique_ptr<AST> Parser::parseBinOpRHS(std::unique_ptr<AST> LHS, int Prec) {
   while (true) {
     const auto Tok = peekToken();
@@ -109,13 +126,28 @@ std::unique_ptr<AST> Parser::parseBinOpRHS(std::unique_ptr<AST> LHS, int Prec) {
     auto RHS = parseUnary();
     const auto NextTok = peekToken();
 
-    if (isBinOp(NextTok) && getPrecedence(NextTok) > Prec)
-      RHS = parseBinOpRHS(std::move(RHS),
-                          getPrecedence(Tok) +
-                              (isRightCombined(NextTok.Kind) ? 0 : 1));
+    // Only operators binding tighter than Tok, or as tight if Tok is right
+    // combined, belong to RHS. Anything else continues this loop, so that
+    // chains of one operator, such as `;`, do not recurse.
+    if (isBinOp(NextTok)) {
+      const int TokPrec = getPrecedence(Tok);
+      const int NextPrec = getPrecedence(NextTok);
+      if (NextPrec > TokPrec)
+        RHS = parseBinOpRHS(std::move(RHS), TokPrec + 1);
+      else if (NextPrec == TokPrec && isRightCombined(Tok.Kind))
+        RHS = parseBinOpRHS(std::move(RHS), TokPrec);
+    }
 
-    LHS =
-        std::make_unique<BinExprAST>(std::move(LHS), std::move(RHS), Tok.Kind);
+    // The target of an assignment and the statements of a sequence are
+    // never shared.
+    if (Tok.Kind == ';')
+      LHS = SequenceAST::append(std::move(LHS), std::move(RHS));
+    else if (Tok.Kind == '=')
+      LHS = std::make_unique<BinExprAST>(std::move(LHS), share(std::move(RHS)),
+                                         Tok.Kind);
+    else
+      LHS = std::make_unique<BinExprAST>(share(std::move(LHS)),
+                                         share(std::move(RHS)), Tok.Kind);
   }
 }
 
@@ -123,7 +155,7 @@ std::unique_ptr<AST> Parser::parseUnary() {
   const auto Tok = peekToken();
   if (isUnOp(Tok)) {
     eatToken();
-    return std::make_unique<UnaryExprAST>(parsePrimary(), Tok.Kind);
+    return std::make_unique<UnaryExprAST>(share(parsePrimary()), Tok.Kind);
   }
   return parsePrimary();
 }
@@ -137,7 +169,7 @@ std::unique_ptr<AST> Parser::parsePrimary() {
     return parseWhileExpr();
   if (Tok == TK_String) {
     eatToken();
-    return std::make_unique<ConstExprAST>(Value{Tok.Str});
+    return std::make_unique<ConstExprAST>(Value{String(Tok.Str)});
   }
   if (Tok == TK_Number) {
     eatToken();
@@ -145,7 +177,7 @@ std::unique_ptr<AST> Parser::parsePrimary() {
   }
   if (Tok == TK_Identifier) {
     eatToken();
-    auto Identifier = std::make_unique<IdentifierAST>(Tok.Str);
+    auto Identifier = std::make_unique<IdentifierAST>(std::string(Tok.Str));
     if (peekToken() == '(') {
       eatToken();
       auto Args = parseArgList();
@@ -200,7 +232,7 @@ std::vector<std::unique_ptr<AST>> Parser::parseArgList() {
   if (Tok == ')')
     return Ret;
   while (true) {
-    Ret.push_back(parseExpr());
+    Ret.push_back(share(parseExpr()));
     if (peekToken() == ')')
       return Ret;
     if (peekToken() == ',')
@@ -228,7 +260,8 @@ std::unique_ptr<AST> Parser::parseIfExpr() {
     E = parseExpr();
   }
 
-  return std::make_unique<IfExprAST>(std::move(C), std::move(T), std::move(E));
+  return std::make_unique<IfExprAST>(share(std::move(C)), share(std::move(T)),
+                                     share(std::move(E)));
 }
 
 std::unique_ptr<AST> Parser::parseWhileExpr() {
@@ -239,7 +272,8 @@ std::unique_ptr<AST> Parser::parseWhileExpr() {
     throw ParseError("Expected `do', but got " + peekToken().descriptionof());
   eatToken();
   auto T = parseExpr();
-  return std::make_unique<WhileExprAST>(std::move(C), std::move(T));
+  return std::make_unique<WhileExprAST>(share(std::move(C)),
+                                        share(std::move(T)));
 }
 
 } // namespace lince
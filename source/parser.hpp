@@ -3,15 +3,17 @@
 #include "exceptions.hpp"
 #include "value.hpp"
 
-#include <map>
+#include <array>
+#include <cstdint>
 #include <memory>
-#include <set>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace lince {
 
+class ASTPool;
+
 enum TokenKind {
   TK_None = 0,
   TK_Identifier = -1,
@@ -31,31 +33,131 @@ enum TokenKind {
 struct Token {
   int Kind;
 
-  std::string Str{};
+  /// Slice of the parsed source; only valid while the source is alive.
+  std::string_view Str{};
 
-  bool operator==(std::string const &RHS) const noexcept {
+  bool operator==(std::string_view RHS) const noexcept {
     return Kind == TK_Identifier && Str == RHS;
   }
   bool operator==(int RHS) const noexcept { return Kind == RHS; }
 
-  Value numberof() const {
-    return Str.find('.') != std::string::npos ? Value{std::stod(Str)}
-                                              : Value{std::stoi(Str)};
-  }
+  /// The value of a number literal: a double if it has a fraction or an
+  /// exponent, otherwise an int, or a long long if it does not fit.
+  Value numberof() const;
 
   std::string descriptionof() const;
 };
 
+namespace lexer {
+
+enum CharClass : std::uint8_t {
+  CC_Space = 1,
+  CC_IdentStart = 2,
+  CC_Ident = 4,
+  CC_Digit = 8,
+  CC_Number = 16,
+  CC_Quote = 32
+};
+
+constexpr std::array<std::uint8_t, 256> makeCharClasses() {
+  std::array<std::uint8_t, 256> T{};
+  for (unsigned char C : {' ', '\t', '\n', '\v', '\f', '\r'})
+    T[C] |= CC_Space;
+  for (int C = 'a'; C <= 'z'; ++C)
+    T[C] |= CC_IdentStart | CC_Ident;
+  for (int C = 'A'; C <= 'Z'; ++C)
+    T[C] |= CC_IdentStart | CC_Ident;
+  T['_'] |= CC_IdentStart | CC_Ident;
+  for (int C = '0'; C <= '9'; ++C)
+    T[C] |= CC_Ident | CC_Digit | CC_Number;
+  for (unsigned char C : {'.', 'e', 'E', '+', '-'})
+    T[C] |= CC_Number;
+  T['\''] |= CC_Quote;
+  T['"'] |= CC_Quote;
+  return T;
+}
+
+constexpr auto CharClasses = makeCharClasses();
+
+constexpr bool is(char C, std::uint8_t Class) noexcept {
+  return CharClasses[static_cast<unsigned char>(C)] & Class;
+}
+
+struct Keyword {
+  std::string_view Name;
+  int Kind;
+};
+
+/// Perfect hash of the keywords below: no two of them collide.
+constexpr unsigned hashKeyword(std::string_view S) noexcept {
+  return (S.front() + 3u * S.back() + S.size()) & 15u;
+}
+
+constexpr Keyword KeywordList[] = {
+    {"if", TK_If},       {"then", TK_Then},   {"else", TK_Else},
+    {"true", TK_True},   {"false", TK_False}, {"nil", TK_Nil},
+    {"while", TK_While}, {"do", TK_Do},
+};
+
+constexpr std::array<Keyword, 16> makeKeywords() {
+  std::array<Keyword, 16> T{};
+  for (const auto &K : KeywordList)
+    T[hashKeyword(K.Name)] = K;
+  return T;
+}
+
+constexpr auto Keywords = makeKeywords();
+
+/// Returns the keyword kind of \p S, or TK_Identifier.
+constexpr int keywordKind(std::string_view S) noexcept {
+  const auto &K = Keywords[hashKeyword(S)];
+  return K.Name == S ? K.Kind : TK_Identifier;
+}
+
+constexpr bool isPerfectHash() {
+  for (const auto &K : KeywordList) {
+    if (keywordKind(K.Name) != K.Kind)
+      return false;
+  }
+  return true;
+}
+
+static_assert(isPerfectHash(), "keyword hash collides");
+
+/// Binding power of each binary operator, 0 for other characters.
+constexpr std::array<std::uint8_t, 128> makePrecedences() {
+  std::array<std::uint8_t, 128> T{};
+  T[';'] = 50;
+  T['='] = 99;
+  T['+'] = T['-'] = 150;
+  T['*'] = T['/'] = 200;
+  T['^'] = 250;
+  return T;
+}
+
+constexpr auto Precedences = makePrecedences();
+
+} // namespace lexer
+
 struct Parser {
   using result_type = Value;
 
-  std::istringstream SS;
+  /// Parses \p Source. If \p Pool is given, equal subtrees are shared
+  /// through it.
+  explicit Parser(std::string_view Source, ASTPool *Pool = nullptr) noexcept
+      : Source(Source), Pool(Pool) {}
+
+  std::string_view Source;
+
+  ASTPool *Pool;
+
+  std::size_t Pos = 0;
 
   Token CurrentToken = {0};
 
   Token parseToken();
 
-  Token peekToken() {
+  const Token &peekToken() {
     if (CurrentToken == 0)
       CurrentToken = parseToken();
     return CurrentToken;
@@ -65,35 +167,23 @@ struct Parser {
 
   std::unique_ptr<AST> parseExpr();
 
-  const std::map<int, unsigned> Precedences{
-      {';', 50},  {'=', 99},  {'+', 150}, {'-', 150},
-      {'*', 200}, {'/', 200}, {'^', 250},
-  };
-
-  const std::map<std::string, int> Keywords{
-      {"if", TK_If},       {"then", TK_Then},   {"else", TK_Else},
-      {"true", TK_True},   {"false", TK_False}, {"nil", TK_Nil},
-      {"while", TK_While}, {"do", TK_Do},
-  };
-
-  const std::set<int> UnaryOperators{'-', '!', '~'};
+  /// \p A, interned if the parser has a pool.
+  std::unique_ptr<AST> share(std::unique_ptr<AST> A);
 
-  const std::set<int> RightCombinedOps{'^', '='};
-
-  bool isBinOp(const Token &Tok) noexcept {
-    return Precedences.find(Tok.Kind) != Precedences.cend();
+  static bool isBinOp(const Token &Tok) noexcept {
+    return Tok.Kind > 0 && Tok.Kind < 128 && lexer::Precedences[Tok.Kind];
   }
 
-  bool isUnOp(const Token &Tok) noexcept {
-    return UnaryOperators.find(Tok.Kind) != UnaryOperators.cend();
+  static bool isUnOp(const Token &Tok) noexcept {
+    return Tok.Kind == '-' || Tok.Kind == '!' || Tok.Kind == '~';
   }
 
-  int getPrecedence(const Token &Tok) { return Precedences.at(Tok.Kind); }
-
-  bool isRightCombined(int C) noexcept {
-    return RightCombinedOps.find(C) != RightCombinedOps.cend();
+  static int getPrecedence(const Token &Tok) noexcept {
+    return lexer::Precedences[Tok.Kind];
   }
 
+  static bool isRightCombined(int C) noexcept { return C == '^' || C == '='; }
+
   std::unique_ptr<AST> parseBinOpRHS(std::unique_ptr<AST> LHS, int Prec);
 
   std::unique_ptr<AST> parseUnary();
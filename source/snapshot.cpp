@@ -0,0 +1,437 @@
+#include "snapshot.hpp"
+#include "astimpl.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace lince {
+
+namespace {
+
+constexpr char Magic[4] = {'S', 'K', 'N', 'A'};
+
+// Nodes nested deeper than this are rejected rather than read with
+// unbounded recursion.
+constexpr unsigned MaxDepth = 10000;
+
+enum class NodeKind : std::uint8_t {
+  Identifier,
+  Unary,
+  Binary,
+  Constant,
+  Call,
+  LambdaCall,
+  If,
+  While,
+  TranslationUnit,
+  Sequence
+};
+
+enum class ConstTag : std::uint8_t { Nil, Bool, Int, Double, String, Int64 };
+
+class SnapshotWriter : public ASTVisitor {
+  std::string Nodes;
+  std::vector<const std::string *> Strings;
+  std::map<std::string, std::uint32_t> StringIndex;
+  std::string Constants;
+  std::uint32_t NConstants = 0;
+  std::map<std::tuple<ConstTag, std::string>, std::uint32_t> ConstantIndex;
+
+  template <typename T> static void put(std::string &Out, T X) {
+    Out.append(reinterpret_cast<const char *>(&X), sizeof(X));
+  }
+
+  void node(NodeKind K) { put(Nodes, static_cast<std::uint8_t>(K)); }
+
+  std::uint32_t intern(const std::string &S) {
+    auto [It, Inserted] = StringIndex.emplace(S, Strings.size());
+    if (Inserted)
+      Strings.push_back(&It->first);
+    return It->second;
+  }
+
+  std::uint32_t constant(const Value &V) {
+    const auto &T = V.Data.type();
+    ConstTag Tag;
+    std::string Payload;
+    if (!V.Data.has_value()) {
+      Tag = ConstTag::Nil;
+    } else if (T == typeid(bool)) {
+      Tag = ConstTag::Bool;
+      put(Payload, static_cast<std::uint8_t>(std::any_cast<bool>(V.Data)));
+    } else if (T == typeid(int)) {
+      Tag = ConstTag::Int;
+      put(Payload, static_cast<std::int32_t>(std::any_cast<int>(V.Data)));
+    } else if (T == typeid(long long)) {
+      Tag = ConstTag::Int64;
+      put(Payload, static_cast<std::int64_t>(std::any_cast<long long>(V.Data)));
+    } else if (T == typeid(double)) {
+      Tag = ConstTag::Double;
+      put(Payload, std::any_cast<double>(V.Data));
+    } else if (T == typeid(String)) {
+      Tag = ConstTag::String;
+      put(Payload, intern(valueCast<std::string>(V)));
+    } else {
+      throw ParseError("Cannot serialize constant: " + V.Info());
+    }
+
+    auto [It, Inserted] =
+        ConstantIndex.emplace(std::make_tuple(Tag, Payload), NConstants);
+    if (Inserted) {
+      put(Constants, static_cast<std::uint8_t>(Tag));
+      Constants += Payload;
+      ++NConstants;
+    }
+    return It->second;
+  }
+
+  void list(const std::vector<std::unique_ptr<AST>> &L) {
+    put(Nodes, static_cast<std::uint32_t>(L.size()));
+    for (auto &&X : L)
+      X->accept(*this);
+  }
+
+public:
+  void visit(const IdentifierAST &A) final {
+    node(NodeKind::Identifier);
+    put(Nodes, intern(A.getName()));
+  }
+
+  void visit(const UnaryExprAST &A) final {
+    node(NodeKind::Unary);
+    put(Nodes, static_cast<std::int32_t>(A.getOp()));
+    A.getOperand().accept(*this);
+  }
+
+  void visit(const BinExprAST &A) final {
+    node(NodeKind::Binary);
+    put(Nodes, static_cast<std::int32_t>(A.getOp()));
+    A.getLHS().accept(*this);
+    A.getRHS().accept(*this);
+  }
+
+  void visit(const SequenceAST &A) final {
+    node(NodeKind::Sequence);
+    list(A.getStatements());
+  }
+
+  void visit(const ConstExprAST &A) final {
+    node(NodeKind::Constant);
+    put(Nodes, constant(A.getValue()));
+  }
+
+  void visit(const CallExprAST &A) final {
+    node(NodeKind::Call);
+    put(Nodes, intern(A.getFunctionName()));
+    list(A.getArgs());
+  }
+
+  void visit(const LambdaCallExpr &A) final {
+    node(NodeKind::LambdaCall);
+    A.getLambda().accept(*this);
+    list(A.getArgs());
+  }
+
+  void visit(const IfExprAST &A) final {
+    node(NodeKind::If);
+    put(Nodes, static_cast<std::uint8_t>(A.getElse() != nullptr));
+    A.getCondition().accept(*this);
+    A.getThen().accept(*this);
+    if (A.getElse())
+      A.getElse()->accept(*this);
+  }
+
+  void visit(const WhileExprAST &A) final {
+    node(NodeKind::While);
+    A.getCondition().accept(*this);
+    A.getBody().accept(*this);
+  }
+
+  void visit(const TranslationUnitAST &A) final {
+    node(NodeKind::TranslationUnit);
+    list(A.getExprList());
+    put(Nodes, static_cast<std::uint32_t>(A.getLines().size()));
+    for (const auto Line : A.getLines())
+      put(Nodes, static_cast<std::uint32_t>(Line));
+  }
+
+  // Temporaries are recreated by the optimizer, only the expressions they
+  // stand for are stored.
+  void visit(const TemporaryScopeAST &A) final { A.getBody().accept(*this); }
+
+  void visit(const TemporaryAST &A) final { A.getExpression().accept(*this); }
+
+  void write(std::ostream &OS) const {
+    std::string Header(Magic, sizeof(Magic));
+    put(Header, SnapshotVersion);
+    put(Header, static_cast<std::uint32_t>(Strings.size()));
+    put(Header, NConstants);
+    OS << Header;
+
+    std::string Table;
+    for (auto S : Strings) {
+      put(Table, static_cast<std::uint32_t>(S->size()));
+      Table += *S;
+    }
+    OS << Table << Constants << Nodes;
+  }
+};
+
+class SnapshotReader {
+  const char *Data;
+  std::size_t Size;
+  std::size_t Pos = 0;
+  std::vector<std::string> Strings;
+  std::vector<Value> Constants;
+  std::uint32_t Version = 0;
+  unsigned Depth = 0;
+
+  template <typename T> T get() {
+    if (Size - Pos < sizeof(T))
+      throw ParseError("Truncated snapshot");
+    T X;
+    std::memcpy(&X, Data + Pos, sizeof(T));
+    Pos += sizeof(T);
+    return X;
+  }
+
+  const std::string &string() {
+    const auto I = get<std::uint32_t>();
+    if (I >= Strings.size())
+      throw ParseError("Bad string index in snapshot");
+    return Strings[I];
+  }
+
+  // A count of items that take at least MinBytes each, checked against the
+  // rest of the snapshot so that a bad count cannot make it reserve memory
+  // it does not need.
+  std::uint32_t count(std::size_t MinBytes) {
+    const auto N = get<std::uint32_t>();
+    if (N > (Size - Pos) / MinBytes)
+      throw ParseError("Truncated snapshot");
+    return N;
+  }
+
+  std::vector<std::unique_ptr<AST>> list() {
+    const auto N = count(1);
+    std::vector<std::unique_ptr<AST>> L;
+    L.reserve(N);
+    for (std::uint32_t I = 0; I != N; ++I)
+      L.push_back(node());
+    return L;
+  }
+
+public:
+  SnapshotReader(const char *Data, std::size_t Size) : Data(Data), Size(Size) {
+    if (!isSnapshot(Data, Size))
+      throw ParseError("Not a snapshot");
+    Pos = sizeof(Magic);
+    Version = get<std::uint32_t>();
+    if (Version == 0 || Version > SnapshotVersion)
+      throw ParseError("Unsupported snapshot version " +
+                       std::to_string(Version));
+
+    const auto NStrings = get<std::uint32_t>();
+    const auto NConstants = get<std::uint32_t>();
+    // Each string takes at least its length and each constant its tag.
+    if (NStrings > (Size - Pos) / sizeof(std::uint32_t))
+      throw ParseError("Truncated snapshot");
+
+    Strings.reserve(NStrings);
+    for (std::uint32_t I = 0; I != NStrings; ++I) {
+      const auto Len = get<std::uint32_t>();
+      if (Size - Pos < Len)
+        throw ParseError("Truncated snapshot");
+      Strings.emplace_back(Data + Pos, Len);
+      Pos += Len;
+    }
+
+    if (NConstants > Size - Pos)
+      throw ParseError("Truncated snapshot");
+    Constants.reserve(NConstants);
+    for (std::uint32_t I = 0; I != NConstants; ++I) {
+      switch (static_cast<ConstTag>(get<std::uint8_t>())) {
+      case ConstTag::Nil:
+        Constants.push_back({});
+        break;
+      case ConstTag::Bool:
+        Constants.push_back({get<std::uint8_t>() != 0});
+        break;
+      case ConstTag::Int:
+        Constants.push_back({static_cast<int>(get<std::int32_t>())});
+        break;
+      case ConstTag::Int64:
+        Constants.push_back({static_cast<long long>(get<std::int64_t>())});
+        break;
+      case ConstTag::Double:
+        Constants.push_back({get<double>()});
+        break;
+      case ConstTag::String:
+        Constants.push_back(makeValue(string()));
+        break;
+      default:
+        throw ParseError("Bad constant tag in snapshot");
+      }
+    }
+  }
+
+  std::unique_ptr<AST> node() {
+    if (Depth == MaxDepth)
+      throw ParseError("Snapshot nested too deeply");
+    ++Depth;
+    auto Node = nodeBody();
+    --Depth;
+    return Node;
+  }
+
+  std::unique_ptr<AST> nodeBody() {
+    switch (static_cast<NodeKind>(get<std::uint8_t>())) {
+    case NodeKind::Identifier:
+      return std::make_unique<IdentifierAST>(string());
+    case NodeKind::Unary: {
+      const auto Op = get<std::int32_t>();
+      if (!Parser::isUnOp(Token{Op}))
+        throw ParseError("Bad operator in snapshot");
+      return std::make_unique<UnaryExprAST>(node(), Op);
+    }
+    case NodeKind::Binary: {
+      const auto Op = get<std::int32_t>();
+      if (!Parser::isBinOp(Token{Op}))
+        throw ParseError("Bad operator in snapshot");
+      auto LHS = node();
+      auto RHS = node();
+      // Older snapshots store sequences as binary expressions.
+      if (Op == ';')
+        return SequenceAST::append(std::move(LHS), std::move(RHS));
+      return std::make_unique<BinExprAST>(std::move(LHS), std::move(RHS), Op);
+    }
+    case NodeKind::Constant: {
+      const auto I = get<std::uint32_t>();
+      if (I >= Constants.size())
+        throw ParseError("Bad constant index in snapshot");
+      return std::make_unique<ConstExprAST>(Constants[I]);
+    }
+    case NodeKind::Call: {
+      auto Name = string();
+      return std::make_unique<CallExprAST>(std::move(Name), list());
+    }
+    case NodeKind::LambdaCall: {
+      auto Lambda = node();
+      return std::make_unique<LambdaCallExpr>(std::move(Lambda), list());
+    }
+    case NodeKind::If: {
+      const bool HasElse = get<std::uint8_t>();
+      auto Condition = node();
+      auto Then = node();
+      auto Else = HasElse ? node() : nullptr;
+      return std::make_unique<IfExprAST>(std::move(Condition), std::move(Then),
+                                         std::move(Else));
+    }
+    case NodeKind::While: {
+      auto Condition = node();
+      auto Body = node();
+      return std::make_unique<WhileExprAST>(std::move(Condition),
+                                            std::move(Body));
+    }
+    case NodeKind::TranslationUnit: {
+      auto ExprList = list();
+      std::vector<std::size_t> Lines;
+      if (Version >= 4) {
+        Lines.resize(count(sizeof(std::uint32_t)));
+        if (!Lines.empty() && Lines.size() != ExprList.size())
+          throw ParseError("Bad line table in snapshot");
+        for (auto &Line : Lines)
+          Line = get<std::uint32_t>();
+      }
+      return std::make_unique<TranslationUnitAST>(std::move(ExprList),
+                                                  std::move(Lines));
+    }
+    case NodeKind::Sequence: {
+      auto Statements = list();
+      if (Statements.size() < 2)
+        throw ParseError("Empty sequence in snapshot");
+      return std::make_unique<SequenceAST>(std::move(Statements));
+    }
+    default:
+      throw ParseError("Bad node kind in snapshot");
+    }
+  }
+
+  bool atEnd() const noexcept { return Pos == Size; }
+};
+
+class MappedFile {
+  void *Addr = MAP_FAILED;
+  std::size_t Length = 0;
+
+public:
+  explicit MappedFile(const std::string &Path) {
+    const int FD = ::open(Path.c_str(), O_RDONLY);
+    if (FD < 0)
+      throw ParseError("Cannot open snapshot: " + Path);
+    struct stat St;
+    if (::fstat(FD, &St) == 0 && St.st_size > 0) {
+      Length = St.st_size;
+      Addr = ::mmap(nullptr, Length, PROT_READ, MAP_PRIVATE, FD, 0);
+    }
+    ::close(FD);
+    if (Addr == MAP_FAILED)
+      throw ParseError("Cannot map snapshot: " + Path);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { ::munmap(Addr, Length); }
+
+  const char *data() const noexcept { return static_cast<const char *>(Addr); }
+
+  std::size_t size() const noexcept { return Length; }
+};
+
+} // namespace
+
+void writeSnapshot(const AST &Program, std::ostream &OS) {
+  SnapshotWriter W;
+  Program.accept(W);
+  W.write(OS);
+}
+
+std::unique_ptr<AST> readSnapshot(const char *Data, std::size_t Size) {
+  SnapshotReader R(Data, Size);
+  auto Program = R.node();
+  if (!R.atEnd())
+    throw ParseError("Trailing bytes in snapshot");
+  return Program;
+}
+
+std::unique_ptr<AST> loadSnapshot(const std::string &Path) {
+  MappedFile F(Path);
+  ::madvise(const_cast<char *>(F.data()), F.size(), MADV_SEQUENTIAL);
+  return readSnapshot(F.data(), F.size());
+}
+
+bool isSnapshot(const char *Data, std::size_t Size) noexcept {
+  return Size >= sizeof(Magic) && std::memcmp(Data, Magic, sizeof(Magic)) == 0;
+}
+
+bool isSnapshotFile(const std::string &Path) noexcept {
+  const int FD = ::open(Path.c_str(), O_RDONLY);
+  if (FD < 0)
+    return false;
+  char Head[sizeof(Magic)];
+  const auto N = ::read(FD, Head, sizeof(Head));
+  ::close(FD);
+  return N > 0 && isSnapshot(Head, N);
+}
+
+} // namespace lince
@@ -0,0 +1,43 @@
+#pragma once
+#include "ast.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace lince {
+
+/// Precompiled form of a parsed program.
+///
+/// Layout (native byte order):
+///   header   "SKNA", u32 version, u32 #strings, u32 #constants
+///   strings  u32 length + bytes, for every interned name or literal
+///   consts   u8 tag + payload, payload of strings is a string index
+///   nodes    the tree in preorder, one u8 kind per node followed by its
+///            operands; a translation unit ends with u32 #lines and the
+///            u32 source line of each statement, if known
+///
+/// Version 2 added 64-bit integer constants, version 3 sequence nodes and
+/// version 4 the source line of each statement of a translation unit.
+/// Snapshots of older versions are still read.
+constexpr std::uint32_t SnapshotVersion = 4;
+
+/// Serializes \p Program into \p OS.
+void writeSnapshot(const AST &Program, std::ostream &OS);
+
+/// Rebuilds a program from a snapshot image held in memory.
+std::unique_ptr<AST> readSnapshot(const char *Data, std::size_t Size);
+
+/// Memory-maps the snapshot at \p Path and rebuilds the program from it.
+std::unique_ptr<AST> loadSnapshot(const std::string &Path);
+
+/// Whether the image starts with the snapshot signature.
+bool isSnapshot(const char *Data, std::size_t Size) noexcept;
+
+/// Whether the file at \p Path starts with the snapshot signature. Only
+/// the signature is read; a file that cannot be read is not a snapshot.
+bool isSnapshotFile(const std::string &Path) noexcept;
+
+} // namespace lince
@@ -1,59 +1,422 @@
 #include "stdlib.hpp"
+#include "datafile.hpp"
+#include "generator.hpp"
 #include "interpreter.hpp"
 
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <exception>
+#include <thread>
+#include <utility>
+
 namespace lince {
 
-StdLibModule::StdLibModule() {
-  addValue("pi", {3.1415926535897});
-  addValue("e", {2.7182818284590});
-  addValue("phi", {0.618033988});
-  addFunction("sqrt", UnaryFunction<double(double)>(std::sqrt));
-  addFunction("exp", UnaryFunction<double(double)>((std::exp)));
-  addFunction("sin", UnaryFunction<double(double)>(std::sin));
-  addFunction("cos", UnaryFunction<double(double)>(std::cos));
-  addFunction("tan", UnaryFunction<double(double)>(std::tan));
-  addFunction("cbrt", UnaryFunction<double(double)>(std::cbrt));
-  addFunction("abs", UnaryFunction<double(double)>(std::abs));
-  addFunction("log", UnaryFunction<double(double)>(std::log));
-  addFunction("log10", UnaryFunction<double(double)>(std::log10));
-  addFunction("operator-", UnaryFunction<double(double)>(std::negate<>()));
-  addFunction("operator-",
-              BinaryFunction<double(double, double)>(std::minus<>()));
-  addFunction("operator+",
-              BinaryFunction<double(double, double)>(std::plus<>()));
-  addFunction("operator*",
-              BinaryFunction<double(double, double)>(std::multiplies<>()));
-  addFunction("operator/",
-              BinaryFunction<double(double, double)>(std::divides<>()));
-  addFunction("operator^", BinaryFunction<double(double, double)>(std::pow));
-  addConstructor<double, int>();
-  addFunction("operator-", UnaryFunction<int(int)>(std::negate<>()));
-  addFunction("operator-", BinaryFunction<int(int, int)>(std::minus<>()));
-  addFunction("operator+", BinaryFunction<int(int, int)>(std::plus<>()));
-  addFunction("operator*", BinaryFunction<int(int, int)>(std::multiplies<>()));
-  addFunction("operator/", BinaryFunction<int(int, int)>(std::divides<>()));
-  addFunction(
-      "operator+",
-      BinaryFunction<std::string(std::string, std::string)>(std::plus<>()));
-  addFunction("operator*", BinaryFunction<std::string(std::string, int)>(
-                               [](const std::string &Str, unsigned N) {
-                                 std::string S;
-                                 while (N--)
-                                   S += Str;
-                                 return S;
-                               }));
-  addFunction("operator;",
-              {[](const auto &, std::vector<Value> A) { return A[1]; },
-               std::vector<std::type_index>(3u, typeid(Value))});
-
-  addFunction("int",
-              UnaryFunction<int(double)>([](double x) { return int(x); }));
-  addFunction("exit", UnaryFunction<void(int)>(std::exit));
-  addFunction("string", UnaryFunction<std::string(int)>(std::to_string));
-  addFunction("string", UnaryFunction<std::string(double)>(std::to_string));
-
-  addFunction("write_line",
-              UnaryFunction<void(std::string const &)>(
-                  [](const auto &S) { return std::puts(S.c_str()); }));
+namespace {
+
+int toInt(double X) { return int(X); }
+
+String concat(const String &A, const String &B) {
+  return String::concat(A, B);
+}
+
+String repeat(const String &S, int N) {
+  return String::repeat(S, N > 0 ? N : 0);
+}
+
+thread_local LineOutput *CurrentOutput = nullptr;
+
+// Lines written to the standard output by different threads are whole.
+void writeLine(const String &S) {
+  const auto Text = S.view();
+  if (CurrentOutput) {
+    CurrentOutput->write(Text);
+    return;
+  }
+  ::flockfile(stdout);
+  std::fwrite(Text.data(), 1, Text.size(), stdout);
+  std::putc('\n', stdout);
+  ::funlockfile(stdout);
+}
+
+// Upper bound on the chunks a range is split into. The split only depends
+// on the length of the range, so results do not depend on the core count.
+constexpr long long MaxChunks = 64;
+
+// Runs Body(Worker, Chunk, First, Last) over [Lo, Hi) split into contiguous
+// chunks. Each thread evaluates on its own fork of \p C, so scopes pushed
+// and variables assigned by the callee stay private to the thread and are
+// discarded afterwards; lines it writes go to the caller's LineOutput. Each
+// chunk is one evaluation of the fork, so the calls it makes allocate from
+// the fork's arena and do not update its symbol index. Idle threads claim
+// the next unprocessed chunk in order. If any chunk throws, the error of
+// the first failing chunk is rethrown once all threads are done.
+template <typename ChunkFn>
+void forEachChunk(Interpreter *C, long long Lo, long long Hi,
+                  std::size_t NChunks, ChunkFn Body) {
+  if (NChunks == 0)
+    return;
+  const long long N = Hi - Lo;
+  const auto NThreads = std::min<std::size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), NChunks);
+
+  // Forks must be created here: fork() updates the caller's symbol index.
+  std::vector<std::unique_ptr<Interpreter>> Workers;
+  for (std::size_t I = 0; I != NThreads; ++I)
+    Workers.emplace_back(new Interpreter(C->fork()));
+
+  std::atomic<std::size_t> Next{0};
+  std::atomic<bool> Failed{false};
+  std::vector<std::exception_ptr> Errors(NChunks);
+
+  const auto Run = [&](Interpreter &W) {
+    while (!Failed.load(std::memory_order_relaxed)) {
+      const auto K = Next.fetch_add(1, std::memory_order_relaxed);
+      if (K >= NChunks)
+        return;
+      const long long First = Lo + N * K / NChunks;
+      const long long Last = Lo + N * (K + 1) / NChunks;
+      try {
+        const Interpreter::EvalGuard Guard(W);
+        Body(W, K, First, Last);
+      } catch (...) {
+        Errors[K] = std::current_exception();
+        Failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> Threads;
+  try {
+    for (std::size_t I = 1; I != NThreads; ++I)
+      Threads.emplace_back(
+          [&Run, Out = CurrentOutput](Interpreter &W) {
+            CurrentOutput = Out;
+            Run(W);
+          },
+          std::ref(*Workers[I]));
+  } catch (...) {
+    Failed = true;
+    for (auto &T : Threads)
+      T.join();
+    throw;
+  }
+  Run(*Workers.front());
+  for (auto &T : Threads)
+    T.join();
+  for (const auto &W : Workers)
+    C->mergeDispatchStats(*W);
+
+  for (const auto &E : Errors) {
+    if (E)
+      std::rethrow_exception(E);
+  }
+}
+
+std::size_t chunkCount(long long Lo, long long Hi) {
+  return static_cast<std::size_t>(std::clamp(Hi - Lo, 0LL, MaxChunks));
+}
+
+Value index(long long I) { return {static_cast<int>(I)}; }
+
+// parallel_map(f, lo, hi): the list f(lo), ..., f(hi - 1).
+Value parallelMap(Interpreter *C, ArgumentList Args) {
+  const auto &F = valueCast<Function>(Args[0]);
+  const long long Lo = valueCast<int>(Args[1]);
+  const long long Hi = valueCast<int>(Args[2]);
+
+  std::vector<Value> Results(std::max(Hi - Lo, 0LL));
+  forEachChunk(C, Lo, Hi, chunkCount(Lo, Hi),
+               [&](Interpreter &W, std::size_t, long long First,
+                   long long Last) {
+                 for (auto I = First; I != Last; ++I)
+                   Results[I - Lo] = W.callFunction(F, {index(I)});
+               });
+  return {List(std::move(Results))};
+}
+
+// parallel_reduce(f, op, lo, hi, init): init op f(lo) op ... op f(hi - 1).
+// Each chunk is folded on its own, then the chunk results are folded in
+// order, so the result equals the sequential fold whenever op is
+// associative.
+Value parallelReduce(Interpreter *C, ArgumentList Args) {
+  const auto &F = valueCast<Function>(Args[0]);
+  const auto &Op = valueCast<Function>(Args[1]);
+  const long long Lo = valueCast<int>(Args[2]);
+  const long long Hi = valueCast<int>(Args[3]);
+
+  std::vector<Value> Partial(chunkCount(Lo, Hi));
+  forEachChunk(C, Lo, Hi, Partial.size(),
+               [&](Interpreter &W, std::size_t K, long long First,
+                   long long Last) {
+                 Value Acc = W.callFunction(F, {index(First)});
+                 for (auto I = First + 1; I != Last; ++I)
+                   Acc = W.callFunction(Op, {std::move(Acc),
+                                             W.callFunction(F, {index(I)})});
+                 Partial[K] = std::move(Acc);
+               });
+
+  Value Acc = std::move(Args[4]);
+  for (auto &P : Partial)
+    Acc = C->callFunction(Op, {std::move(Acc), std::move(P)});
+  return Acc;
+}
+
+int size(const List &L) { return static_cast<int>(L.size()); }
+
+Value at(const List &L, int I) {
+  if (I < 0 || static_cast<std::size_t>(I) >= L.size())
+    throw EvalError("Index out of range: " + std::to_string(I));
+  return L.elements()[I];
+}
+
+Column::ElementType elementType(const std::string &Name) {
+  if (Name == "i32")
+    return Column::Int32;
+  if (Name == "i64")
+    return Column::Int64;
+  if (Name == "f32")
+    return Column::Float32;
+  if (Name == "f64")
+    return Column::Float64;
+  throw EvalError("Unknown element type: " + Name);
+}
+
+// read_binary(path, type): the numbers of type "i32", "i64", "f32" or
+// "f64" that make up the file, mapped rather than read.
+Column readBinary(const std::string &Path, const std::string &Type) {
+  return mapColumn(Path, elementType(Type));
+}
+
+// read_binary(path, type, fields, field): field of each record of fields
+// numbers.
+Column readRecords(const std::string &Path, const std::string &Type,
+                   int Fields, int Field) {
+  if (Fields <= 0 || Field < 0)
+    throw EvalError("Invalid record layout");
+  return mapColumn(Path, elementType(Type), Fields, Field);
 }
+
+// read_table(path): a list with a column per field of a text file.
+List readTableColumns(const std::string &Path) {
+  auto Columns = readTable(Path);
+  std::vector<Value> Elements;
+  for (auto &C : Columns)
+    Elements.push_back({std::move(C)});
+  return List(std::move(Elements));
+}
+
+// An int if it fits, as with integer literals.
+Value columnSize(const Column &C) {
+  if (C.size() <= static_cast<std::size_t>(INT_MAX))
+    return {static_cast<int>(C.size())};
+  return {static_cast<long long>(C.size())};
+}
+
+template <typename Index> Value columnAt(const Column &C, Index I) {
+  if (I < 0 || static_cast<std::size_t>(I) >= C.size())
+    throw EvalError("Index out of range: " + std::to_string(I));
+  return C.at(I);
+}
+
+// slice(c, lo, hi): elements lo to hi - 1 of c, clamped to its bounds.
+template <typename Index> Column slice(const Column &C, Index Lo, Index Hi) {
+  return C.slice(std::max<Index>(Lo, 0), std::max<Index>(Hi, 0));
+}
+
+double mean(const Column &C) {
+  if (C.size() == 0)
+    throw EvalError("Mean of an empty column");
+  return sum(C) / C.size();
+}
+
+// fold(c, op, init): init op c[0] op ... op c[n - 1], from the left.
+Value foldColumn(Interpreter *C, ArgumentList Args) {
+  const auto &Col = valueCast<Column>(Args[0]);
+  const auto &Op = valueCast<Function>(Args[1]);
+  Value Acc = std::move(Args[2]);
+  for (std::size_t I = 0; I != Col.size(); ++I)
+    Acc = C->callFunction(Op, {std::move(Acc), Col.at(I)});
+  return Acc;
+}
+
+using Cursor = Generator::Pipeline::Cursor;
+using Stage = Generator::Pipeline::Stage;
+
+// range(lo, hi): lo, lo + 1, ... while less than hi.
+template <typename T> Generator range(T Lo, T Hi) {
+  return makeGenerator([Lo, Hi]() -> Cursor {
+    return [X = Lo, Hi](Interpreter &, Value &V) mutable {
+      if (!(X < Hi))
+        return false;
+      V = {X};
+      X += 1;
+      return true;
+    };
+  });
+}
+
+// iterate(f, x): x, f(x), f(f(x)), ... without end.
+Generator iterate(Function F, Value X) {
+  return makeGenerator([F, X]() -> Cursor {
+    return [F, X, Started = false](Interpreter &I, Value &V) mutable {
+      if (Started)
+        X = I.callFunction(F, {std::move(X)});
+      Started = true;
+      V = X;
+      return true;
+    };
+  });
+}
+
+// each(s): the elements of a list or column.
+template <typename Sequence> Generator each(Sequence S) {
+  return makeGenerator([S]() -> Cursor {
+    return [S, I = std::size_t(0)](Interpreter &, Value &V) mutable {
+      if (I == S.size())
+        return false;
+      if constexpr (std::is_same_v<Sequence, List>)
+        V = S.elements()[I++];
+      else
+        V = S.at(I++);
+      return true;
+    };
+  });
+}
+
+// map(g, f), filter(g, p) and take(g, n) add a stage to g.
+Generator map(const Generator &G, Function F) {
+  return addStage(G, {Stage::Map, {std::move(F)}});
+}
+
+Generator filter(const Generator &G, Function P) {
+  return addStage(G, {Stage::Filter, {std::move(P)}});
+}
+
+template <typename Count> Generator take(const Generator &G, Count N) {
+  return addStage(G, {Stage::Take, {}, N});
+}
+
+// fold(g, op, init): init op g0 op g1 op ..., in a single pass over g.
+Value foldGenerator(Interpreter *C, ArgumentList Args) {
+  const auto &G = valueCast<Generator>(Args[0]);
+  const auto &Op = valueCast<Function>(Args[1]);
+  Value Acc = std::move(Args[2]);
+  forEach(*C, G, [&](Value &V) {
+    Acc = C->callFunction(Op, {std::move(Acc), std::move(V)});
+    return true;
+  });
+  return Acc;
+}
+
+// list(g): the values of g. Never returns if g is endless.
+Value collect(Interpreter *C, ArgumentList Args) {
+  std::vector<Value> Elements;
+  forEach(*C, valueCast<Generator>(Args[0]), [&](Value &V) {
+    Elements.push_back(std::move(V));
+    return true;
+  });
+  return {List(std::move(Elements))};
+}
+
+const NativeValue Values[] = {
+    {"pi", {3.1415926535897}},
+    {"e", {2.7182818284590}},
+    {"phi", {0.618033988}},
+};
+
+const NativeFunction Functions[] = {
+    native<double(double), std::sqrt>("sqrt").pure(),
+    native<double(double), std::exp>("exp").pure(),
+    native<double(double), std::sin>("sin").pure(),
+    native<double(double), std::cos>("cos").pure(),
+    native<double(double), std::tan>("tan").pure(),
+    native<double(double), std::cbrt>("cbrt").pure(),
+    native<double(double), std::abs>("abs").pure(),
+    native<double(double), std::log>("log").pure(),
+    native<double(double), std::log10>("log10").pure(),
+    native<double(double), std::negate<>>("operator-").pure(),
+    native<double(double, double), std::minus<>>("operator-").pure(),
+    native<double(double, double), std::plus<>>("operator+").pure(),
+    native<double(double, double), std::multiplies<>>("operator*").pure(),
+    native<double(double, double), std::divides<>>("operator/").pure(),
+    native<double(double, double), std::pow>("operator^").pure(),
+    nativeConstructor<double, int>().pure(),
+    native<int(int), std::negate<>>("operator-").pure(),
+    native<int(int, int), std::minus<>>("operator-").pure(),
+    native<int(int, int), std::plus<>>("operator+").pure(),
+    native<int(int, int), std::multiplies<>>("operator*").pure(),
+    native<int(int, int), std::divides<>>("operator/").pure(),
+    nativeConstructor<long long, int>().pure(),
+    nativeConstructor<double, long long>().pure(),
+    native<long long(long long), std::negate<>>("operator-").pure(),
+    native<long long(long long, long long), std::minus<>>("operator-").pure(),
+    native<long long(long long, long long), std::plus<>>("operator+").pure(),
+    native<long long(long long, long long), std::multiplies<>>("operator*")
+        .pure(),
+    native<long long(long long, long long), std::divides<>>("operator/")
+        .pure(),
+    native<concat>("operator+").pure(),
+    native<repeat>("operator*").pure(),
+
+    native<toInt>("int").pure(),
+    native<void(int), std::exit>("exit"),
+    native<numberString<int>>("string").pure(),
+    native<numberString<long long>>("string").pure(),
+    native<numberString<double>>("string").pure(),
+
+    native<writeLine>("write_line"),
+
+    native<size>("size").pure(),
+    native<at>("at").pure(),
+    native<Value(Function, int, int)>("parallel_map", parallelMap),
+    native<Value(Function, Function, int, int, Value)>("parallel_reduce",
+                                                       parallelReduce),
+
+    native<readBinary>("read_binary"),
+    native<readRecords>("read_binary"),
+    native<readTableColumns>("read_table"),
+    native<columnSize>("size").pure(),
+    native<columnAt<int>>("at").pure(),
+    native<columnAt<long long>>("at").pure(),
+    native<slice<int>>("slice").pure(),
+    native<slice<long long>>("slice").pure(),
+    native<double(const Column &), sum>("sum").pure(),
+    native<double(const Column &), min>("min").pure(),
+    native<double(const Column &), max>("max").pure(),
+    native<mean>("mean").pure(),
+    native<Value(Column, Function, Value)>("fold", foldColumn),
+
+    native<range<int>>("range").pure(),
+    native<range<long long>>("range").pure(),
+    native<range<double>>("range").pure(),
+    native<iterate>("iterate").pure(),
+    native<each<List>>("each").pure(),
+    native<each<Column>>("each").pure(),
+    native<map>("map").pure(),
+    native<filter>("filter").pure(),
+    native<take<int>>("take").pure(),
+    native<take<long long>>("take").pure(),
+    native<Value(Generator, Function, Value)>("fold", foldGenerator),
+    native<Value(Generator)>("list", collect),
+};
+
+} // namespace
+
+LineOutput::LineOutput(std::string &Out)
+    : Out(Out), Saved(std::exchange(CurrentOutput, this)) {}
+
+LineOutput::~LineOutput() { CurrentOutput = Saved; }
+
+void LineOutput::write(std::string_view Line) {
+  std::lock_guard<std::mutex> Lock(M);
+  Out.append(Line);
+  Out += '\n';
+}
+
+const NativeModule &StdLibModule() {
+  static const NativeModule M(Functions, Values);
+  return M;
+}
+
 } // namespace lince
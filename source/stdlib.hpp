@@ -1,9 +1,31 @@
 #pragma once
 #include "module.hpp"
 
+#include <mutex>
+#include <string>
+#include <string_view>
+
 namespace lince {
-class StdLibModule : public Module {
+/// The standard library. Its tables are static and shared by every
+/// interpreter, so adding it to one is O(1).
+const NativeModule &StdLibModule();
+
+/// While an instance exists, write_line on the thread that created it, and
+/// in the parallel_map and parallel_reduce workers started from there,
+/// appends to \p Out instead of writing to the standard output. Lines
+/// written by parallel workers are whole but in no particular order.
+class LineOutput {
+  std::string &Out;
+  std::mutex M;
+  LineOutput *Saved;
+
 public:
-  StdLibModule();
+  explicit LineOutput(std::string &Out);
+  ~LineOutput();
+
+  LineOutput(const LineOutput &) = delete;
+  LineOutput &operator=(const LineOutput &) = delete;
+
+  void write(std::string_view Line);
 };
 } // namespace lince
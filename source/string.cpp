@@ -0,0 +1,193 @@
+#include "exceptions.hpp"
+#include "value.hpp"
+
+#include <cstring>
+#include <limits>
+#include <new>
+
+namespace lince {
+
+namespace {
+
+// Concatenations shorter than this are copied rather than made into ropes,
+// and a short string appended to a rope is merged into its last piece if
+// the two fit, so that the pieces of a rope are mostly about this long.
+constexpr std::size_t LeafBytes = 512;
+
+} // namespace
+
+struct String::Rope : Rep {
+  String Left, Right;
+  // The text, once it has been needed: a reference to a Rep that is not a
+  // rope.
+  mutable std::atomic<Rep *> Flat{nullptr};
+
+  Rope(String L, String R)
+      : Rep{{1}, L.size() + R.size(), true}, Left(std::move(L)),
+        Right(std::move(R)) {}
+};
+
+String::Rep *String::makeFlat(std::size_t Size) {
+  auto *R = new (::operator new(sizeof(Rep) + Size + 1)) Rep{{1}, Size, false};
+  text(R)[Size] = '\0';
+  return R;
+}
+
+String String::makeInline(std::string_view A, std::string_view B) {
+  String S;
+  S.Word = (A.size() + B.size()) << 1 | 1;
+  auto *Text = reinterpret_cast<char *>(&S.Word) + 1;
+  std::copy(A.begin(), A.end(), Text);
+  std::copy(B.begin(), B.end(), Text + A.size());
+  return S;
+}
+
+String String::makeRope(String Left, String Right) {
+  return String(new Rope(std::move(Left), std::move(Right)));
+}
+
+String::String(std::string_view S) {
+  if (S.size() <= InlineCapacity) {
+    *this = makeInline(S);
+    return;
+  }
+  auto *R = makeFlat(S.size());
+  std::memcpy(text(R), S.data(), S.size());
+  Word = reinterpret_cast<std::uintptr_t>(R);
+}
+
+// Ropes built by appending in a loop are as deep as the loop is long, so
+// they are freed without recursion: ropes whose last reference is dropped
+// are kept on a list linked through their Size.
+void String::destroy(Rep *R) noexcept {
+  Rope *Pending = nullptr;
+  const auto Free = [&](Rep *Dead) {
+    if (!Dead->IsRope) {
+      Dead->~Rep();
+      ::operator delete(Dead);
+      return;
+    }
+    auto *P = static_cast<Rope *>(Dead);
+    P->Size = reinterpret_cast<std::uintptr_t>(Pending);
+    Pending = P;
+  };
+
+  Free(R);
+  while (Pending) {
+    auto *P = Pending;
+    Pending = reinterpret_cast<Rope *>(static_cast<std::uintptr_t>(P->Size));
+    if (auto *F = P->Flat.load(std::memory_order_acquire);
+        F && F->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      Free(F);
+    for (auto *Half : {&P->Left, &P->Right}) {
+      const auto W = std::exchange(Half->Word, 1);
+      auto *H = reinterpret_cast<Rep *>(W);
+      if (!(W & 1) && H->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        Free(H);
+    }
+    delete P;
+  }
+}
+
+// Copies the pieces into one buffer from the end, so that the stack of
+// pieces still to copy stays short for ropes that grew to the right.
+std::string_view String::flatten() const {
+  const auto *P = static_cast<const Rope *>(rep());
+  if (auto *F = P->Flat.load(std::memory_order_acquire))
+    return {text(F), F->Size};
+
+  auto *F = makeFlat(P->Size);
+  auto End = P->Size;
+  std::vector<const String *> Stack{this};
+  while (!Stack.empty()) {
+    const auto *S = Stack.back();
+    Stack.pop_back();
+    if (!S->isInline() && S->rep()->IsRope) {
+      const auto *Q = static_cast<const Rope *>(S->rep());
+      if (!Q->Flat.load(std::memory_order_acquire)) {
+        Stack.push_back(&Q->Left);
+        Stack.push_back(&Q->Right);
+        continue;
+      }
+    }
+    const auto Piece = S->view();
+    End -= Piece.size();
+    std::memcpy(text(F) + End, Piece.data(), Piece.size());
+  }
+
+  Rep *Installed = nullptr;
+  if (!P->Flat.compare_exchange_strong(Installed, F,
+                                       std::memory_order_acq_rel)) {
+    destroy(F);
+    F = Installed;
+  }
+  return {text(F), F->Size};
+}
+
+String String::compact(const String &S) {
+  if (S.isInline() || !S.rep()->IsRope)
+    return S;
+  auto *F = static_cast<const Rope *>(S.rep())->Flat.load(
+      std::memory_order_acquire);
+  if (!F)
+    return S;
+  F->Refs.fetch_add(1, std::memory_order_relaxed);
+  return String(F);
+}
+
+String String::concat(const String &Front, const String &Back) {
+  auto A = compact(Front), B = compact(Back);
+  const auto NA = A.size(), NB = B.size();
+  if (NB == 0)
+    return A;
+  if (NA == 0)
+    return B;
+  if (NA + NB <= InlineCapacity)
+    return makeInline(A.view(), B.view());
+
+  if (NA + NB < LeafBytes) {
+    const auto VA = A.view(), VB = B.view();
+    auto *R = makeFlat(NA + NB);
+    std::memcpy(text(R), VA.data(), NA);
+    std::memcpy(text(R) + NA, VB.data(), NB);
+    return String(R);
+  }
+
+  if (NB < LeafBytes && !A.isInline() && A.rep()->IsRope) {
+    const auto &L = static_cast<const Rope &>(*A.rep());
+    if (L.Right.size() + NB < LeafBytes)
+      return makeRope(L.Left, concat(L.Right, B));
+  }
+  if (NA < LeafBytes && !B.isInline() && B.rep()->IsRope) {
+    const auto &R = static_cast<const Rope &>(*B.rep());
+    if (NA + R.Left.size() < LeafBytes)
+      return makeRope(concat(A, R.Left), R.Right);
+  }
+  return makeRope(std::move(A), std::move(B));
+}
+
+String String::repeat(const String &S, std::size_t N) {
+  const auto Piece = S.view();
+  if (N == 0 || Piece.empty())
+    return {};
+  if (N == 1)
+    return S;
+  if (Piece.size() > std::numeric_limits<std::size_t>::max() / 2 / N)
+    throw EvalError("String too long");
+  const auto Size = Piece.size() * N;
+  if (Size <= InlineCapacity) {
+    String R = S;
+    while (R.size() < Size)
+      R = makeInline(R.view(), Piece);
+    return R;
+  }
+
+  // Each copy doubles the part filled so far.
+  auto *R = makeFlat(Size);
+  std::memcpy(text(R), Piece.data(), Piece.size());
+  for (auto Filled = Piece.size(); Filled < Size; Filled *= 2)
+    std::memcpy(text(R) + Filled, text(R), std::min(Filled, Size - Filled));
+  return String(R);
+}
+
+} // namespace lince
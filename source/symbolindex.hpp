@@ -0,0 +1,54 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace lince {
+
+/// Sorted multiset of bound names answering prefix queries in
+/// O(log n + results). Counts may be negative when the index records the
+/// difference to another index; names whose count drops to zero are
+/// erased, so the index only holds live names.
+class SymbolIndex {
+  std::map<std::string, int, std::less<>> Count;
+
+  void adjust(std::string_view Name, int Delta) {
+    auto It = Count.find(Name);
+    if (It == Count.end())
+      It = Count.emplace(std::string(Name), 0).first;
+    if ((It->second += Delta) == 0)
+      Count.erase(It);
+  }
+
+public:
+  void add(std::string_view Name) { adjust(Name, 1); }
+
+  void remove(std::string_view Name) { adjust(Name, -1); }
+
+  int count(std::string_view Name) const noexcept {
+    const auto It = Count.find(Name);
+    return It != Count.end() ? It->second : 0;
+  }
+
+  /// Whether every count is zero.
+  bool empty() const noexcept { return Count.empty(); }
+
+  /// Adds the counts of \p Delta to this index.
+  void merge(const SymbolIndex &Delta) {
+    for (const auto &[Name, N] : Delta.Count)
+      adjust(Name, N);
+  }
+
+  /// Calls \p Fn with every name starting with \p Prefix and its count.
+  template <typename Callback>
+  void forEachWithPrefix(std::string_view Prefix, Callback &&Fn) const {
+    for (auto It = Count.lower_bound(Prefix);
+         It != Count.end() && It->first.compare(0, Prefix.size(), Prefix) == 0;
+         ++It)
+      Fn(std::string_view(It->first), It->second);
+  }
+};
+
+} // namespace lince
@@ -0,0 +1,62 @@
+#pragma once
+#include "value.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace lince {
+
+/// Values of the temporaries introduced by the optimizer, one frame for
+/// every TemporaryScopeAST being evaluated. A slot is filled the first time
+/// its expression is evaluated within the frame.
+class TemporaryStack {
+public:
+  struct Slot {
+    Value V;
+    bool Ready = false;
+  };
+
+  struct ScopeGuard {
+    TemporaryStack *S;
+
+    explicit ScopeGuard(TemporaryStack *S) noexcept : S(S) {}
+
+    ScopeGuard(const ScopeGuard &) = delete;
+    ScopeGuard &operator=(const ScopeGuard &) = delete;
+
+    ~ScopeGuard() { S->pop(); }
+  };
+
+  /// Opens a frame of \p N empty slots for \p Scope.
+  [[nodiscard]] ScopeGuard enter(const void *Scope, std::size_t N) {
+    Frames.push_back({Scope, Slots.size()});
+    Slots.resize(Slots.size() + N);
+    return ScopeGuard(this);
+  }
+
+  /// Slot \p I of the innermost frame of \p Scope, or null if \p Scope has
+  /// no frame. Invalidated by entering another frame.
+  Slot *find(const void *Scope, std::size_t I) noexcept {
+    for (auto F = Frames.rbegin(); F != Frames.rend(); ++F) {
+      if (F->Scope == Scope)
+        return &Slots[F->Base + I];
+    }
+    return nullptr;
+  }
+
+private:
+  struct Frame {
+    const void *Scope;
+    std::size_t Base;
+  };
+
+  void pop() {
+    Slots.resize(Frames.back().Base);
+    Frames.pop_back();
+  }
+
+  std::vector<Slot> Slots;
+  std::vector<Frame> Frames;
+};
+
+} // namespace lince
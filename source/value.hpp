@@ -1,11 +1,20 @@
 #pragma once
 #include "demangle.hpp"
+#include "expected.hpp"
 
+#include <algorithm>
 #include <any>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <typeindex>
+#include <utility>
 #include <vector>
 
 namespace lince {
@@ -13,6 +22,242 @@ namespace lince {
 class AST;
 class Interpreter;
 
+/// Immutable string shared between copies of a Value. A string is one
+/// word, so a Value stores it without allocating: strings of up to seven
+/// bytes are held inline, and longer ones are reference-counted.
+///
+/// Concatenating long strings makes a rope, whose text is copied into one
+/// buffer the first time it is needed, so building a string piece by
+/// piece takes time linear in its length.
+class String {
+  struct Rep {
+    std::atomic<std::size_t> Refs{1};
+    std::size_t Size;
+    bool IsRope;
+  };
+  struct Rope;
+
+  static constexpr std::size_t InlineCapacity = sizeof(std::uintptr_t) - 1;
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+                "inline strings need the length in the lowest byte");
+
+  // A Rep, or an inline string if the lowest bit is set: the first byte
+  // holds the length shifted left by one and the others the text.
+  std::uintptr_t Word = 1;
+
+  explicit String(Rep *R) noexcept
+      : Word(reinterpret_cast<std::uintptr_t>(R)) {}
+
+  bool isInline() const noexcept { return Word & 1; }
+
+  Rep *rep() const noexcept { return reinterpret_cast<Rep *>(Word); }
+
+  // Text of a Rep that is not a rope, followed by a null character.
+  static char *text(Rep *R) noexcept { return reinterpret_cast<char *>(R + 1); }
+
+  static Rep *makeFlat(std::size_t Size);
+  static String makeInline(std::string_view A, std::string_view B = {});
+  static String makeRope(String Left, String Right);
+  static void destroy(Rep *R) noexcept;
+
+  std::string_view flatten() const;
+
+  // S, or its text if it is a rope that has been flattened, so that ropes
+  // made from it do not keep both alive.
+  static String compact(const String &S);
+
+  void release() noexcept {
+    if (!isInline() && rep()->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      destroy(rep());
+  }
+
+public:
+  String() noexcept = default;
+
+  String(std::string_view S);
+  String(const std::string &S) : String(std::string_view(S)) {}
+  String(const char *S) : String(std::string_view(S)) {}
+
+  String(const String &Other) noexcept : Word(Other.Word) {
+    if (!isInline())
+      rep()->Refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  String(String &&Other) noexcept : Word(std::exchange(Other.Word, 1)) {}
+
+  String &operator=(String Other) noexcept {
+    std::swap(Word, Other.Word);
+    return *this;
+  }
+
+  ~String() { release(); }
+
+  std::size_t size() const noexcept {
+    return isInline() ? (Word & 0xff) >> 1 : rep()->Size;
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  /// The text. The first call on a rope copies it into one buffer, which
+  /// later calls, on this string or its copies, reuse.
+  std::string_view view() const {
+    if (isInline())
+      return {reinterpret_cast<const char *>(&Word) + 1, size()};
+    if (!rep()->IsRope)
+      return {text(rep()), rep()->Size};
+    return flatten();
+  }
+
+  std::string str() const { return std::string(view()); }
+
+  /// \p A followed by \p B. Takes time independent of the length of
+  /// \p A and \p B unless either is short.
+  static String concat(const String &A, const String &B);
+
+  /// \p S repeated \p N times, in time linear in the length of the
+  /// result.
+  static String repeat(const String &S, std::size_t N);
+};
+
+/// Formats the number \p X independently of the locale. Floating-point
+/// numbers are written as the shortest text that reads back as \p X, with
+/// ".0" appended where that text would otherwise read back as an integer.
+template <typename T> std::string numberString(T X) {
+  char Buffer[64];
+  auto End = std::to_chars(Buffer, Buffer + sizeof(Buffer) - 2, X).ptr;
+  if constexpr (std::is_floating_point_v<T>) {
+    if (std::all_of(Buffer, End, [](char C) {
+          return C == '-' || (C >= '0' && C <= '9');
+        })) {
+      *End++ = '.';
+      *End++ = '0';
+    }
+  }
+  return std::string(Buffer, End);
+}
+
+struct Value;
+
+/// Immutable sequence of values. Copies share the elements.
+class List {
+  std::shared_ptr<const std::vector<Value>> Ptr;
+
+public:
+  List();
+
+  explicit List(std::vector<Value> Elements);
+
+  const std::vector<Value> &elements() const noexcept { return *Ptr; }
+
+  std::size_t size() const noexcept;
+
+  std::string stringof() const;
+};
+
+/// Immutable sequence of numbers of one type, viewing memory shared by
+/// copies: a mapped file, or numbers parsed from one. Elements are a
+/// fixed stride apart, so a column can view one field of fixed-size
+/// records.
+class Column {
+public:
+  enum ElementType : std::uint8_t { Int32, Int64, Float32, Float64 };
+
+private:
+  std::shared_ptr<const void> Owner;
+  const char *Base = nullptr;
+  std::size_t Count = 0;
+  std::size_t Stride = sizeof(double);
+  ElementType Type = Float64;
+
+  template <typename T> T load(std::size_t I) const noexcept {
+    T X;
+    std::memcpy(&X, Base + I * Stride, sizeof(T));
+    return X;
+  }
+
+public:
+  Column() = default;
+
+  /// \p Count elements of type \p Type starting at \p Base, in memory
+  /// kept alive by \p Owner.
+  Column(std::shared_ptr<const void> Owner, const char *Base,
+         std::size_t Count, std::size_t Stride, ElementType Type) noexcept
+      : Owner(std::move(Owner)), Base(Base), Count(Count), Stride(Stride),
+        Type(Type) {}
+
+  explicit Column(std::vector<double> Numbers) {
+    auto P = std::make_shared<const std::vector<double>>(std::move(Numbers));
+    Base = reinterpret_cast<const char *>(P->data());
+    Count = P->size();
+    Owner = std::move(P);
+  }
+
+  static std::size_t sizeOf(ElementType T) noexcept {
+    return T == Int32 || T == Float32 ? 4 : 8;
+  }
+
+  std::size_t size() const noexcept { return Count; }
+  ElementType type() const noexcept { return Type; }
+
+  /// Calls \p F with a function that reads element I as the stored type,
+  /// so that loops over the elements branch on the type only once.
+  template <typename Fn> decltype(auto) visit(Fn &&F) const {
+    switch (Type) {
+    case Int32:
+      return F([this](std::size_t I) { return load<std::int32_t>(I); });
+    case Int64:
+      return F([this](std::size_t I) { return load<std::int64_t>(I); });
+    case Float32:
+      return F([this](std::size_t I) { return load<float>(I); });
+    default:
+      return F([this](std::size_t I) { return load<double>(I); });
+    }
+  }
+
+  /// Element \p I converted to double.
+  double number(std::size_t I) const noexcept {
+    return visit([I](auto Load) { return static_cast<double>(Load(I)); });
+  }
+
+  /// Elements [\p First, \p Last), sharing this column's memory.
+  Column slice(std::size_t First, std::size_t Last) const noexcept {
+    Last = std::min(Last, Count);
+    First = std::min(First, Last);
+    return {Owner, Base + First * Stride, Last - First, Stride, Type};
+  }
+
+  /// Element \p I as an int, long long or double.
+  Value at(std::size_t I) const;
+
+  std::string stringof() const;
+};
+
+/// Lazy sequence of values, produced one at a time by a source and passed
+/// through map, filter and take stages; see generator.hpp. Copies share
+/// the pipeline, and every traversal starts from the beginning.
+class Generator {
+public:
+  struct Pipeline;
+
+  explicit Generator(std::shared_ptr<const Pipeline> P) noexcept
+      : P(std::move(P)) {}
+
+  const Pipeline &pipeline() const noexcept { return *P; }
+
+  std::string stringof() const { return "<Generator>"; }
+
+private:
+  std::shared_ptr<const Pipeline> P;
+};
+
+/// Maps a C++ parameter or result type to the type stored inside a Value.
+template <typename T> struct StorageOf { using type = T; };
+
+template <> struct StorageOf<std::string> { using type = String; };
+
+template <typename T>
+using StorageType = typename StorageOf<std::decay_t<T>>::type;
+
 struct Value {
   std::any Data;
 
@@ -25,6 +270,8 @@ struct Value {
       return std::any_cast<bool>(Data);
     if (Data.type() == typeid(int))
       return 0 != std::any_cast<int>(Data);
+    if (Data.type() == typeid(long long))
+      return 0 != std::any_cast<long long>(Data);
     return true;
   }
 
@@ -38,22 +285,176 @@ struct Value {
     if (isFunction())
       return "<Function>";
     if (Data.type() == typeid(double))
-      return std::to_string(std::any_cast<double>(Data));
+      return numberString(std::any_cast<double>(Data));
     if (Data.type() == typeid(long double))
-      return std::to_string(std::any_cast<long double>(Data));
+      return numberString(std::any_cast<long double>(Data));
     if (Data.type() == typeid(int))
-      return std::to_string(std::any_cast<int>(Data));
-    if (Data.type() == typeid(std::string))
-      return '\"' + std::any_cast<std::string>(Data) + '\"';
+      return numberString(std::any_cast<int>(Data));
+    if (Data.type() == typeid(long long))
+      return numberString(std::any_cast<long long>(Data));
+    if (Data.type() == typeid(String))
+      return '\"' + std::any_cast<const String &>(Data).str() + '\"';
+    if (Data.type() == typeid(List))
+      return std::any_cast<const List &>(Data).stringof();
+    if (Data.type() == typeid(Column))
+      return std::any_cast<const Column &>(Data).stringof();
+    if (Data.type() == typeid(Generator))
+      return std::any_cast<const Generator &>(Data).stringof();
     if (Data.type() == typeid(bool))
       return std::any_cast<bool>(Data) ? "true" : "false";
     return "<Value>";
   }
 };
 
-struct Function {
-  std::function<Value(Interpreter *, std::vector<Value>)> Data;
-  std::vector<std::type_index> Type;
+inline List::List() : List(std::vector<Value>()) {}
+
+inline List::List(std::vector<Value> Elements)
+    : Ptr(std::make_shared<const std::vector<Value>>(std::move(Elements))) {}
+
+inline std::size_t List::size() const noexcept { return Ptr->size(); }
+
+inline std::string List::stringof() const {
+  std::string S = "[";
+  for (const auto &V : *Ptr) {
+    if (S.size() > 1)
+      S += ", ";
+    S += V.stringof();
+  }
+  return S + ']';
+}
+
+inline Value Column::at(std::size_t I) const {
+  switch (Type) {
+  case Int32:
+    return {static_cast<int>(load<std::int32_t>(I))};
+  case Int64:
+    return {static_cast<long long>(load<std::int64_t>(I))};
+  default:
+    return {number(I)};
+  }
+}
+
+/// Prints at most the first 8 elements, as columns can be huge.
+inline std::string Column::stringof() const {
+  constexpr std::size_t Shown = 8;
+  std::string S = "[";
+  for (std::size_t I = 0; I != std::min(Count, Shown); ++I) {
+    if (I != 0)
+      S += ", ";
+    S += at(I).stringof();
+  }
+  if (Count > Shown)
+    S += ", ... (" + std::to_string(Count) + " elements)";
+  return S + ']';
+}
+
+/// Arguments of a call. Allocated from the interpreter's per-evaluation
+/// memory while an evaluation is running.
+using ArgumentList = std::pmr::vector<Value>;
+
+/// Borrows the payload of \p V as a \p T without copying it. A \p T of
+/// std::string is the exception and gets a copy of the text; take a String
+/// to avoid it.
+template <typename T> decltype(auto) valueCast(const Value &V) {
+  if constexpr (std::is_same_v<std::decay_t<T>, Value>)
+    return V;
+  else if constexpr (std::is_same_v<std::decay_t<T>, std::string>)
+    return std::any_cast<const String &>(V.Data).str();
+  else
+    return std::any_cast<const std::decay_t<T> &>(V.Data);
+}
+
+/// The payload of \p V as an argument for a parameter of type \p T, when
+/// the call owns \p V: reference parameters refer into \p V, and the
+/// payload is moved out of it for the others. Parameters of type
+/// std::string get a copy of the text; take a String to avoid it.
+template <typename T> decltype(auto) argumentCast(Value &V) {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same_v<U, std::string>) {
+    return std::any_cast<const String &>(V.Data).str();
+  } else if constexpr (std::is_same_v<U, Value>) {
+    if constexpr (std::is_lvalue_reference_v<T>)
+      return (V);
+    else
+      return std::move(V);
+  } else if constexpr (std::is_lvalue_reference_v<T>) {
+    return std::any_cast<U &>(V.Data);
+  } else {
+    return std::move(std::any_cast<U &>(V.Data));
+  }
+}
+
+template <typename T> Value makeValue(T &&X) {
+  if constexpr (std::is_same_v<std::decay_t<T>, Value>)
+    return std::forward<T>(X);
+  else
+    return {StorageType<T>(std::forward<T>(X))};
+}
+
+/// View of a function signature: the result type followed by the
+/// parameter types.
+class TypeList {
+  const std::type_index *First;
+  const std::type_index *Last;
+
+public:
+  TypeList(const std::type_index *First, const std::type_index *Last) noexcept
+      : First(First), Last(Last) {}
+
+  const std::type_index *begin() const noexcept { return First; }
+  const std::type_index *end() const noexcept { return Last; }
+  const std::type_index *cbegin() const noexcept { return First; }
+  const std::type_index *cend() const noexcept { return Last; }
+
+  const std::type_index &front() const noexcept { return *First; }
+
+  std::size_t size() const noexcept { return Last - First; }
+};
+
+/// Callable bound to a signature. Copies share the callable and its
+/// signature, so passing functions around as values does not allocate.
+/// Native entry points with a signature in static storage are held
+/// directly, without any allocation or type erasure.
+class Function {
+public:
+  using Body = std::function<Value(Interpreter *, ArgumentList)>;
+  using Thunk = Value (*)(Interpreter *, ArgumentList);
+
+  /// Calls \p Target, a function pointer cast to void (*)() that the
+  /// invoker casts back to its own type.
+  using Invoker = Value (*)(void (*Target)(), Interpreter *, ArgumentList);
+
+  using CheckedBody =
+      std::function<Expected<Value>(Interpreter *, ArgumentList)>;
+
+  Function(Body Data, std::vector<std::type_index> Type)
+      : Function(std::make_shared<const Impl>(
+            Impl{std::move(Data), std::move(Type), {}})) {}
+
+  /// A function that returns its errors instead of throwing them, such as
+  /// one defined by a script.
+  static Function checked(CheckedBody Data,
+                          std::vector<std::type_index> Type) {
+    return Function(std::make_shared<const Impl>(
+        Impl{{}, std::move(Type), std::move(Data)}));
+  }
+
+  Function(Thunk Native, TypeList Type) noexcept
+      : Native(Native), Type(Type) {}
+
+  Function(Invoker Call, void (*Target)(), TypeList Type) noexcept
+      : Call(Call), Target(Target), Type(Type) {}
+
+  TypeList getType() const noexcept { return Type; }
+
+  /// Whether calls only compute a result from the arguments, without side
+  /// effects, so that the optimizer may reuse the result of a call.
+  bool isPure() const noexcept { return Pure; }
+
+  Function &setPure(bool P = true) noexcept {
+    Pure = P;
+    return *this;
+  }
 
   template <typename Sequence> bool matchType(const Sequence &ArgType) const {
     return std::equal(std::cbegin(ArgType), std::cend(ArgType),
@@ -62,9 +463,81 @@ struct Function {
                          const std::type_index &RHS) { return LHS == RHS; });
   }
 
-  Value operator()(Interpreter *I, std::vector<Value> Args) const {
-    return Data(I, std::move(Args));
+  /// Whether the parameter types are exactly the types of \p Args.
+  template <typename Sequence> bool matchArgs(const Sequence &Args) const {
+    return std::equal(std::cbegin(Args), std::cend(Args), Type.cbegin() + 1,
+                      Type.cend(), [](const auto &V, const std::type_index &T) {
+                        return T == V.Data.type();
+                      });
   }
+
+  Value operator()(Interpreter *I, ArgumentList Args) const {
+    if (Native)
+      return Native(I, std::move(Args));
+    if (Call)
+      return Call(Target, I, std::move(Args));
+    if (Ptr->Checked)
+      return Ptr->Checked(I, std::move(Args)).get();
+    return Ptr->Data(I, std::move(Args));
+  }
+
+  /// Calls the function, returning the EvalError or ParseError that it
+  /// throws, if any, as an Error.
+  Expected<Value> call(Interpreter *I, ArgumentList &&Args) const {
+    if (Ptr && Ptr->Checked)
+      return Ptr->Checked(I, std::move(Args));
+    try {
+      if (Native)
+        return Native(I, std::move(Args));
+      if (Call)
+        return Call(Target, I, std::move(Args));
+      return Ptr->Data(I, std::move(Args));
+    } catch (const EvalError &E) {
+      return E.getError();
+    } catch (const ParseError &E) {
+      return Error{Error::Parse, E.what()};
+    }
+  }
+
+private:
+  struct Impl {
+    Body Data;
+    std::vector<std::type_index> Type;
+    CheckedBody Checked;
+  };
+
+  explicit Function(std::shared_ptr<const Impl> P) noexcept
+      : Ptr(std::move(P)),
+        Type(Ptr->Type.data(), Ptr->Type.data() + Ptr->Type.size()) {}
+
+  Thunk Native = nullptr;
+  Invoker Call = nullptr;
+  void (*Target)() = nullptr;
+  std::shared_ptr<const Impl> Ptr;
+  TypeList Type;
+  bool Pure = false;
+};
+
+/// View of contiguous overload candidates.
+class FunctionRange {
+  const Function *First = nullptr;
+  const Function *Last = nullptr;
+
+public:
+  FunctionRange() noexcept = default;
+
+  FunctionRange(const Function *First, const Function *Last) noexcept
+      : First(First), Last(Last) {}
+
+  explicit FunctionRange(const std::vector<Function> &V) noexcept
+      : First(V.data()), Last(V.data() + V.size()) {}
+
+  const Function *begin() const noexcept { return First; }
+  const Function *end() const noexcept { return Last; }
+  const Function *cbegin() const noexcept { return First; }
+  const Function *cend() const noexcept { return Last; }
+
+  bool empty() const noexcept { return First == Last; }
 };
 
 inline bool Value::isFunction() const noexcept {
@@ -78,17 +551,68 @@ template <typename R, typename... Args> struct Signature<R(Args...)> {
   using Arguments = std::tuple<Args...>;
 
   static std::vector<std::type_index> TypeIndices() {
-    return {typeid(R), typeid(Args)...};
+    return {typeid(StorageType<R>), typeid(StorageType<Args>)...};
+  }
+
+  /// The same signature in static storage.
+  static TypeList Types() {
+    static const std::type_index Indices[] = {typeid(StorageType<R>),
+                                              typeid(StorageType<Args>)...};
+    return {std::cbegin(Indices), std::cend(Indices)};
   }
 };
 
+/// Deduces the signature \c Type of a callable: a function, a pointer to
+/// function or member function, or a class with one operator(). Member
+/// functions take the object as their first parameter.
+template <typename F>
+struct CallableSignature : CallableSignature<decltype(&F::operator())> {
+  using Type = typename CallableSignature<decltype(&F::operator())>::Call;
+};
+
+template <typename R, typename... Args> struct CallableSignature<R(Args...)> {
+  using Type = R(Args...);
+};
+
+template <typename R, typename... Args>
+struct CallableSignature<R(Args...) noexcept> : CallableSignature<R(Args...)> {
+};
+
+template <typename R, typename... Args>
+struct CallableSignature<R (*)(Args...)> : CallableSignature<R(Args...)> {};
+
+template <typename R, typename... Args>
+struct CallableSignature<R (*)(Args...) noexcept>
+    : CallableSignature<R(Args...)> {};
+
+template <typename R, typename C, typename... Args>
+struct CallableSignature<R (C::*)(Args...)> {
+  using Type = R(C &, Args...);
+  using Call = R(Args...);
+};
+
+template <typename R, typename C, typename... Args>
+struct CallableSignature<R (C::*)(Args...) const> {
+  using Type = R(const C &, Args...);
+  using Call = R(Args...);
+};
+
+template <typename R, typename C, typename... Args>
+struct CallableSignature<R (C::*)(Args...) noexcept>
+    : CallableSignature<R (C::*)(Args...)> {};
+
+template <typename R, typename C, typename... Args>
+struct CallableSignature<R (C::*)(Args...) const noexcept>
+    : CallableSignature<R (C::*)(Args...) const> {};
+
 template <typename Fn, typename... Args>
 Value invokeForValue(Fn &&F, Args &&... A) {
   if constexpr (std::is_void_v<std::invoke_result_t<Fn &&, Args &&...>>) {
     std::invoke(std::forward<Fn>(F), std::forward<Args>(A)...);
     return {{}};
   } else {
-    return {std::invoke(std::forward<Fn>(F), std::forward<Args>(A)...)};
+    return makeValue(
+        std::invoke(std::forward<Fn>(F), std::forward<Args>(A)...));
   }
 }
 